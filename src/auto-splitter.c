@@ -1,9 +1,13 @@
+#include <limits.h>
 #include <linux/limits.h>
 #include <pthread.h>
 #include <pwd.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
@@ -13,20 +17,51 @@
 #include <lualib.h>
 
 #include "auto-splitter.h"
+#include "event-ring.h"
+#include "lua-arena.h"
+#include "memory-backend.h"
 #include "memory.h"
 #include "process.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "script-cache.h"
 #include "settings.h"
+#include "sigscan.h"
+#include "timer.h"
+#include "trace.h"
+#include "watcher.h"
 
 char auto_splitter_file[PATH_MAX];
-int refresh_rate = 60;
-int maps_cache_cycles = 0; // 0=off, 1=current cycle, +1=multiple cycles
-int maps_cache_cycles_value = 0; // same as `maps_cache_cycles` but this one represents the current value rather than the reference from the script
+_Thread_local int refresh_rate = 60;
+_Thread_local enum overrun_policy overrun_policy = OVERRUN_SKIP;
 atomic_bool auto_splitter_enabled = true;
-atomic_bool call_start = false;
-atomic_bool call_split = false;
-atomic_bool toggle_loading = false;
-atomic_bool call_reset = false;
-bool prev_is_loading;
+_Thread_local bool prev_is_loading;
+static _Thread_local uint64_t skipped_callbacks = 0; // Callbacks `triggers` didn't run
+
+#define GC_MAX_BUDGET 2000000 // Nanoseconds of collection per tick, when not behind
+#define DEFAULT_MEMORY_LIMIT 128 // MiB a script can use, see lua-arena.h
+
+static _Thread_local struct {
+    uint64_t last_time; // Nanoseconds spent collecting after the last tick
+    uint64_t max_time;
+    uint64_t total_time;
+    uint64_t cycles;
+} gc_statistics;
+
+auto_splitter_instance auto_splitter_instances[AUTO_SPLITTER_MAX_INSTANCES];
+int auto_splitter_instance_count = 1;
+
+// The instance running on this thread
+static _Thread_local auto_splitter_instance* current_instance = NULL;
+
+/*
+    Events for the GTK thread go through the ring of the instance that sent
+    them, each one carries the time it was detected at so it can be applied
+    at that time no matter when the GTK thread gets to it
+    `auto_splitter_event_fd` is an eventfd shared by all instances that's
+    written after each push
+*/
+int auto_splitter_event_fd = -1;
 
 static const char* disabled_functions[] = {
     "collectgarbage",
@@ -42,11 +77,10 @@ static const char* disabled_functions[] = {
     "rawget",
     "rawset",
     "module",
-    "require",
     "newproxy",
 };
 
-extern game_process process;
+extern _Thread_local game_process process;
 
 // I have no idea how this works
 // https://stackoverflow.com/a/2336245
@@ -133,122 +167,450 @@ void disable_functions(lua_State* L, const char** functions)
     }
 }
 
+enum callback {
+    CALLBACK_STARTUP,
+    CALLBACK_STATE,
+    CALLBACK_UPDATE,
+    CALLBACK_START,
+    CALLBACK_SPLIT,
+    CALLBACK_IS_LOADING,
+    CALLBACK_RESET,
+    CALLBACK_COUNT,
+};
+
+static const char* callback_names[] = {
+    "startup",
+    "state",
+    "update",
+    "start",
+    "split",
+    "isLoading",
+    "reset",
+};
+
+/*
+    A callback listed in `triggers` only runs when one of the watchers it
+    depends on changed, or once `triggerTimeout` went by without it running
+*/
+typedef struct callback_trigger {
+    bool enabled;
+    int* inputs; // Watcher indices
+    int input_count;
+    long long last_run;
+} callback_trigger;
+
+// A loaded script, hot reloading builds a second one next to the running one
+typedef struct auto_splitter_script {
+    lua_State* L;
+    int callback_refs[CALLBACK_COUNT]; // Registry references, LUA_NOREF if not defined
+    int tick_ref;
+    callback_trigger triggers[CALLBACK_COUNT];
+    long long trigger_timeout; // Microseconds, 0 to wait for changes forever
+    int gc_pause; // Percent, see collect_garbage
+    int gc_threshold; // KiB in use that start the next collection cycle
+    bool gc_collecting; // In the middle of a cycle
+    bool memory_limit_reported;
+} auto_splitter_script;
+
+// Options scripts can change in `startup`, restored when a reload fails
+typedef struct script_options {
+    int refresh_rate;
+    enum overrun_policy overrun_policy;
+    int pointer_cache_cycles;
+    bool page_snapshot_enabled;
+    const char* memory_backend;
+} script_options;
+
 /*
-    Generic function to call lua functions
-    Signatures are something like `disb>s`
-    1. d = double
-    2. i = int
-    3. s = string
-    4. b = boolean
-    5. > = return separator
-
-    Example: `call_va("functionName", "dd>d", x, y, &z);`
+    Runs state, update, start, split, isLoading and reset with a single call
+    into Lua. Every callback is protected on its own so a failing one doesn't
+    stop the others, errors go through `report`. `pcall` is captured before
+    the script runs so redefining it doesn't change anything
+    `mark` is the profiler's, nil when it's disabled
+    The tick function takes one boolean per callback, false skips it
 */
-bool call_va(lua_State* L, const char* func, const char* sig, ...)
+static const char* tick_dispatcher = "local pcall = pcall\n"
+                                     "return function(report, mark, changed, G, state, update, start, split, isLoading, reset)\n"
+                                     "    local function run(name, section, callback, enabled)\n"
+                                     "        if not callback or not enabled then return nil end\n"
+                                     "        local ok, result = pcall(callback)\n"
+                                     "        if mark then mark(section) end\n"
+                                     "        if not ok then report(name, result) return nil end\n"
+                                     "        return result\n"
+                                     "    end\n"
+                                     "    return function(run_state, run_update, run_start, run_split, run_is_loading, run_reset)\n"
+                                     "        run('state', 0, G.state, run_state)\n"
+                                     "        run('update', 1, G.update, run_update)\n"
+                                     "        local start_result = run('start', 2, G.start, run_start)\n"
+                                     "        local split_result = run('split', 3, G.split, run_split)\n"
+                                     "        local is_loading_result = run('isLoading', 4, G.isLoading, run_is_loading)\n"
+                                     "        local reset_result = run('reset', 5, G.reset, run_reset)\n"
+                                     "        if G.state ~= state or G.update ~= update or G.start ~= start or G.split ~= split or G.isLoading ~= isLoading or G.reset ~= reset then\n"
+                                     "            state, update, start, split, isLoading, reset = G.state, G.update, G.start, G.split, G.isLoading, G.reset\n"
+                                     "            changed()\n"
+                                     "        end\n"
+                                     "        return start_result, split_result, is_loading_result, reset_result\n"
+                                     "    end\n"
+                                     "end\n";
+
+// Set by the tick function when the script assigned other callbacks
+static _Thread_local bool callbacks_changed = false;
+
+static int note_callbacks_changed(lua_State* L)
 {
-    va_list vl;
-    int narg, nres; /* number of arguments and results */
+    callbacks_changed = true;
+    return 0;
+}
 
-    va_start(vl, sig);
-    lua_getglobal(L, func); /* get function */
+static int report_callback_error(lua_State* L)
+{
+    printf("error running function '%s': %s\n", lua_tostring(L, 1), lua_tostring(L, 2));
+    return 0;
+}
 
-    /* push arguments */
-    narg = 0;
-    while (*sig) { /* push arguments */
-        switch (*sig++) {
-            case 'd': /* double argument */
-                lua_pushnumber(L, va_arg(vl, double));
-                break;
+// Calls a callback that takes no arguments and returns nothing
+static bool call_ref(auto_splitter_script* script, enum callback callback)
+{
+    lua_State* L = script->L;
+    if (script->callback_refs[callback] == LUA_NOREF)
+        return false;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, script->callback_refs[callback]);
+    if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+        printf("error running function '%s': %s\n", callback_names[callback], lua_tostring(L, -1));
+        lua_pop(L, 1); // Remove the error message from the stack
+        return false;
+    }
+    return true;
+}
 
-            case 'i': /* int argument */
-                lua_pushnumber(L, va_arg(vl, int));
-                break;
+/*
+    Reads a boolean returned by a callback
+    nil means "no answer", anything else that isn't a boolean is an error
+*/
+static bool to_callback_bool(lua_State* L, int index, enum callback callback, bool* result)
+{
+    switch (lua_type(L, index)) {
+        case LUA_TBOOLEAN:
+            *result = lua_toboolean(L, index);
+            return true;
+        case LUA_TNIL:
+            return false;
+        default:
+            printf("function '%s' wrong result type, expected boolean\n", callback_names[callback]);
+            return false;
+    }
+}
 
-            case 's': /* string argument */
-                lua_pushstring(L, va_arg(vl, char*));
-                break;
+// Calls a callback that takes no arguments and returns a boolean
+static bool call_bool_ref(auto_splitter_script* script, enum callback callback, bool* result)
+{
+    lua_State* L = script->L;
+    if (script->callback_refs[callback] == LUA_NOREF)
+        return false;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, script->callback_refs[callback]);
+    if (lua_pcall(L, 0, 1, 0) != LUA_OK) {
+        printf("error running function '%s': %s\n", callback_names[callback], lua_tostring(L, -1));
+        lua_pop(L, 1); // Remove the error message from the stack
+        return false;
+    }
+    bool ok = to_callback_bool(L, -1, callback, result);
+    lua_pop(L, 1); // Remove the return value from the stack
+    return ok;
+}
 
-            case 'b':
-                lua_pushboolean(L, va_arg(vl, int));
-                break;
+// Takes a reference to every callback the script defines right now
+static void resolve_callback_refs(auto_splitter_script* script)
+{
+    lua_State* L = script->L;
+    for (int i = 0; i < CALLBACK_COUNT; i++) {
+        luaL_unref(L, LUA_REGISTRYINDEX, script->callback_refs[i]);
+        lua_getglobal(L, callback_names[i]);
+        if (lua_isfunction(L, -1)) {
+            script->callback_refs[i] = luaL_ref(L, LUA_REGISTRYINDEX);
+        } else {
+            script->callback_refs[i] = LUA_NOREF;
+            lua_pop(L, 1); // Remove the global from the stack
+        }
+    }
+}
 
-            case '>':
-                break;
+/*
+    Looks up the callbacks once `startup` ran and builds the tick function
+    out of them. The tick function still calls whatever the globals hold,
+    and has the references taken again when they change
+    Returns false if the tick function couldn't be built, the callbacks are
+    looked up and called one by one every tick then
+*/
+static bool resolve_callbacks(auto_splitter_script* script)
+{
+    lua_State* L = script->L;
+    resolve_callback_refs(script);
 
-            default:
-                printf("invalid option (%c)\n", *(sig - 1));
-                return false;
-        }
-        if (*(sig - 1) == '>')
+    script->tick_ref = LUA_NOREF;
+    if (luaL_loadstring(L, tick_dispatcher) != LUA_OK || lua_pcall(L, 0, 1, 0) != LUA_OK) {
+        printf("Couldn't build the tick function: %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1); // Remove the error message from the stack
+        return false;
+    }
+    lua_pushcfunction(L, report_callback_error);
+    if (profiler_enabled)
+        lua_pushcfunction(L, profiler_mark);
+    else
+        lua_pushnil(L);
+    lua_pushcfunction(L, note_callbacks_changed);
+    lua_pushvalue(L, LUA_GLOBALSINDEX);
+    for (int i = CALLBACK_STATE; i <= CALLBACK_RESET; i++)
+        lua_rawgeti(L, LUA_REGISTRYINDEX, script->callback_refs[i]); // LUA_NOREF pushes nil
+    if (lua_pcall(L, 4 + CALLBACK_RESET - CALLBACK_STATE + 1, 1, 0) != LUA_OK) {
+        printf("Couldn't build the tick function: %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1); // Remove the error message from the stack
+        return false;
+    }
+    script->tick_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    return true;
+}
+
+// Creates the eventfd, has to be called before the auto splitter thread starts
+bool auto_splitter_events_init()
+{
+    auto_splitter_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return auto_splitter_event_fd != -1;
+}
+
+/*
+    Reads the extra scripts from the settings, has to be called before the
+    auto splitter threads start
+*/
+void auto_splitter_instances_init()
+{
+    for (int i = 0; i < AUTO_SPLITTER_MAX_INSTANCES; i++)
+        auto_splitter_instances[i].index = i;
+    auto_splitter_instance_count = 1;
+
+    json_t* files = get_setting_value("libresplit", "auto_splitter_extra_files");
+    if (files == NULL)
+        return;
+    for (size_t i = 0; i < json_array_size(files); i++) {
+        json_t* file = json_array_get(files, i);
+        if (!json_is_string(file))
+            continue;
+        if (auto_splitter_instance_count == AUTO_SPLITTER_MAX_INSTANCES) {
+            printf("Too many auto splitters, only %d can run at once\n", AUTO_SPLITTER_MAX_INSTANCES);
             break;
-        narg++;
-        luaL_checkstack(L, 1, "too many arguments");
+        }
+        auto_splitter_instance* instance = &auto_splitter_instances[auto_splitter_instance_count++];
+        snprintf(instance->file, sizeof(instance->file), "%s", json_string_value(file));
     }
+    json_decref(files);
+}
 
-    /* do the call */
-    nres = strlen(sig); /* number of expected results */
-    if (lua_pcall(L, narg, nres, 0) != LUA_OK) {
-        const char* err = lua_tostring(L, -1);
-        printf("error running function '%s': %s\n", func, err);
-        return false;
+// Instance 0 follows the file picked in the menu
+// Index of the instance running on this thread, 0 outside of one
+int auto_splitter_instance_index()
+{
+    return current_instance != NULL ? current_instance->index : 0;
+}
+
+const char* auto_splitter_instance_file(const auto_splitter_instance* instance)
+{
+    return instance->index == 0 ? auto_splitter_file : instance->file;
+}
+
+static void push_event(enum auto_splitter_event_type type, bool loading, long long time)
+{
+    auto_splitter_event event = { .type = type, .loading = loading, .time = time, .instance = current_instance->index };
+    if (!event_ring_push(&current_instance->events, &event)) {
+        printf("Auto splitter event queue is full, dropping an event\n");
+        return;
+    }
+    if (auto_splitter_event_fd != -1) {
+        uint64_t one = 1;
+        if (write(auto_splitter_event_fd, &one, sizeof(one)) == -1) {
+            // Counter is already non-zero, the GTK thread will wake up anyway
+        }
+    }
+}
+
+/*
+    Called from the GTK thread
+    Returns the oldest event of all instances so they're applied in the
+    order they happened in
+*/
+bool auto_splitter_pop_event(auto_splitter_event* event)
+{
+    event_ring* oldest = NULL;
+    for (int i = 0; i < auto_splitter_instance_count; i++) {
+        auto_splitter_event head;
+        if (event_ring_peek(&auto_splitter_instances[i].events, &head) && (oldest == NULL || head.time < event->time)) {
+            oldest = &auto_splitter_instances[i].events;
+            *event = head;
+        }
+    }
+    return oldest != NULL && event_ring_pop(oldest, event);
+}
+
+static void handle_start(bool start, long long time)
+{
+    if (start)
+        push_event(AUTO_SPLITTER_EVENT_START, false, time);
+}
+
+static void handle_split(bool split, long long time)
+{
+    if (split)
+        push_event(AUTO_SPLITTER_EVENT_SPLIT, false, time);
+}
+
+static void handle_is_loading(bool loading, long long time)
+{
+    if (loading != prev_is_loading) {
+        push_event(AUTO_SPLITTER_EVENT_LOADING, loading, time);
+        prev_is_loading = loading;
     }
+}
+
+static void handle_reset(bool reset, long long time)
+{
+    if (reset)
+        push_event(AUTO_SPLITTER_EVENT_RESET, false, time);
+}
+
+static void (*const callback_handlers[])(bool, long long) = {
+    [CALLBACK_START] = handle_start,
+    [CALLBACK_SPLIT] = handle_split,
+    [CALLBACK_IS_LOADING] = handle_is_loading,
+    [CALLBACK_RESET] = handle_reset,
+};
+
+// Whether a callback has to run this tick, see `triggers`
+static bool callback_due(auto_splitter_script* script, enum callback callback, long long time)
+{
+    callback_trigger* trigger = &script->triggers[callback];
+    if (!trigger->enabled || script->callback_refs[callback] == LUA_NOREF)
+        return true;
+
+    // Runs on the first tick no matter what
+    bool due = trigger->last_run == 0 || (script->trigger_timeout > 0 && time - trigger->last_run >= script->trigger_timeout);
+    for (int i = 0; !due && i < trigger->input_count; i++)
+        due = watcher_changed(script->L, trigger->inputs[i]);
+    if (due)
+        trigger->last_run = time;
+    else
+        skipped_callbacks++;
+    return due;
+}
 
-    /* retrieve results */
-    nres = -nres; /* stack index of first result */
-    /* check if there's a return value */
-    if (!lua_isnil(L, nres)) {
-        while (*sig) { /* get results */
-            switch (*sig++) {
-                case 'd': /* double result */
-                    if (!lua_isnumber(L, nres)) {
-                        printf("function '%s' wrong result type, expected double\n", func);
-                        return false;
-                    }
-                    *va_arg(vl, double*) = lua_tonumber(L, nres);
-                    break;
-
-                case 'i': /* int result */
-                    if (!lua_isnumber(L, nres)) {
-                        printf("function '%s' wrong result type, expected int\n", func);
-                        return false;
-                    }
-                    *va_arg(vl, int*) = (int)lua_tonumber(L, nres);
-                    break;
-
-                case 's': /* string result */
-                    if (!lua_isstring(L, nres)) {
-                        printf("function '%s' wrong result type, expected string\n", func);
-                        return false;
-                    }
-                    *va_arg(vl, const char**) = lua_tostring(L, nres);
-                    break;
-
-                case 'b':
-                    if (!lua_isboolean(L, nres)) {
-                        printf("function '%s' wrong result type, expected boolean\n", func);
-                        return false;
-                    }
-                    *va_arg(vl, bool*) = lua_toboolean(L, nres);
-                    break;
-
-                default:
-                    printf("invalid option (%c)\n", *(sig - 1));
-                    return false;
+/*
+    Runs all the callbacks of a tick
+    `time` is when the tick started, the values the callbacks look at were
+    read right after it
+    Lua isn't entered at all when every callback is waiting on its triggers
+*/
+static void tick(auto_splitter_script* script, long long time)
+{
+    lua_State* L = script->L;
+    bool result;
+    bool due[CALLBACK_COUNT];
+    bool any_due = false;
+    for (int i = CALLBACK_STATE; i <= CALLBACK_RESET; i++) {
+        due[i] = callback_due(script, i, time);
+        any_due = any_due || (due[i] && script->callback_refs[i] != LUA_NOREF);
+    }
+    if (!any_due)
+        return;
+
+    if (script->tick_ref == LUA_NOREF) {
+        resolve_callback_refs(script);
+        for (int i = CALLBACK_STATE; i <= CALLBACK_RESET; i++) {
+            if (!due[i])
+                continue;
+            uint64_t start = profiler_enabled ? profiler_now() : 0;
+            bool called = i <= CALLBACK_UPDATE ? call_ref(script, i) : call_bool_ref(script, i, &result);
+            if (profiler_enabled && script->callback_refs[i] != LUA_NOREF)
+                profiler_record(PROFILE_STATE + i - CALLBACK_STATE, start);
+            if (called && i >= CALLBACK_START)
+                callback_handlers[i](result, time);
+        }
+        return;
+    }
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, script->tick_ref);
+    for (int i = CALLBACK_STATE; i <= CALLBACK_RESET; i++)
+        lua_pushboolean(L, due[i]);
+    int status = lua_pcall(L, CALLBACK_RESET - CALLBACK_STATE + 1, 4, 0);
+    if (callbacks_changed) {
+        callbacks_changed = false;
+        resolve_callback_refs(script);
+    }
+    if (status != LUA_OK) {
+        printf("error running tick: %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1); // Remove the error message from the stack
+        return;
+    }
+    for (int i = CALLBACK_START; i <= CALLBACK_RESET; i++) {
+        if (to_callback_bool(L, i - CALLBACK_RESET - 1, i, &result))
+            callback_handlers[i](result, time);
+    }
+    lua_pop(L, 4); // Remove the return values from the stack
+}
+
+/*
+    Reads `triggers`, a table of watcher names per callback, and
+    `triggerTimeout` in milliseconds
+    The watchers have to be declared before, usually earlier in `startup`
+*/
+static void read_triggers(auto_splitter_script* script)
+{
+    lua_State* L = script->L;
+
+    lua_getglobal(L, "triggerTimeout");
+    if (lua_isnumber(L, -1)) {
+        script->trigger_timeout = (long long)(lua_tonumber(L, -1) * 1000);
+    }
+    lua_pop(L, 1); // Remove 'triggerTimeout' from the stack
+
+    lua_getglobal(L, "triggers");
+    if (!lua_istable(L, -1)) {
+        lua_pop(L, 1); // Remove 'triggers' from the stack
+        return;
+    }
+    for (int i = CALLBACK_STATE; i <= CALLBACK_RESET; i++) {
+        lua_getfield(L, -1, callback_names[i]);
+        if (!lua_istable(L, -1)) {
+            lua_pop(L, 1); // Remove the inputs from the stack
+            continue;
+        }
+
+        callback_trigger* trigger = &script->triggers[i];
+        int count = lua_objlen(L, -1);
+        trigger->inputs = calloc(count > 0 ? count : 1, sizeof(int));
+        if (trigger->inputs == NULL) {
+            lua_pop(L, 1); // Remove the inputs from the stack
+            continue;
+        }
+        trigger->enabled = true;
+        for (int input = 1; input <= count; input++) {
+            lua_rawgeti(L, -1, input);
+            const char* name = lua_tostring(L, -1);
+            int index = name != NULL ? watcher_index(L, name) : -1;
+            if (index == -1) {
+                // Can't tell when it changes, the callback runs every tick
+                printf("triggers: '%s' isn't a watcher, '%s' runs every tick\n", name != NULL ? name : "?", callback_names[i]);
+                trigger->enabled = false;
+            } else {
+                trigger->inputs[trigger->input_count++] = index;
             }
-            nres++;
+            lua_pop(L, 1); // Remove the name from the stack
         }
-    } else {
-        va_end(vl);
-        return false;
+        lua_pop(L, 1); // Remove the inputs from the stack
     }
-    va_end(vl);
-    return true;
+    lua_pop(L, 1); // Remove 'triggers' from the stack
 }
 
-void startup(lua_State* L)
+void startup(auto_splitter_script* script)
 {
-    lua_getglobal(L, "startup");
-    lua_pcall(L, 0, 0, 0);
+    lua_State* L = script->L;
+    call_ref(script, CALLBACK_STARTUP);
 
     lua_getglobal(L, "refreshRate");
     if (lua_isnumber(L, -1)) {
@@ -256,184 +618,648 @@ void startup(lua_State* L)
     }
     lua_pop(L, 1); // Remove 'refreshRate' from the stack
 
-    lua_getglobal(L, "mapsCacheCycles");
+    lua_getglobal(L, "overrunPolicy");
+    if (lua_isstring(L, -1)) {
+        overrun_policy = overrun_policy_from_string(lua_tostring(L, -1));
+    }
+    lua_pop(L, 1); // Remove 'overrunPolicy' from the stack
+
+    lua_getglobal(L, "pointerCacheCycles");
     if (lua_isnumber(L, -1)) {
-        maps_cache_cycles = lua_tointeger(L, -1);
-        maps_cache_cycles_value = maps_cache_cycles;
+        pointer_cache_cycles = lua_tointeger(L, -1);
+    }
+    lua_pop(L, 1); // Remove 'pointerCacheCycles' from the stack
+
+    lua_getglobal(L, "pageSnapshot");
+    if (lua_isboolean(L, -1)) {
+        page_snapshot_enabled = lua_toboolean(L, -1);
+    }
+    lua_pop(L, 1); // Remove 'pageSnapshot' from the stack
+
+    lua_getglobal(L, "memoryBackend");
+    if (lua_isstring(L, -1)) {
+        memory_backend_select(lua_tostring(L, -1));
+    }
+    lua_pop(L, 1); // Remove 'memoryBackend' from the stack
+
+    lua_getglobal(L, "gcPause");
+    if (lua_isnumber(L, -1) && lua_tointeger(L, -1) > 0) {
+        script->gc_pause = lua_tointeger(L, -1);
+    }
+    lua_pop(L, 1); // Remove 'gcPause' from the stack
+
+    lua_getglobal(L, "gcStepMul");
+    if (lua_isnumber(L, -1) && lua_tointeger(L, -1) > 0) {
+        lua_gc(L, LUA_GCSETSTEPMUL, lua_tointeger(L, -1));
+    }
+    lua_pop(L, 1); // Remove 'gcStepMul' from the stack
+
+    read_triggers(script);
+}
+
+// Selects the memory backend from the settings, scripts can override it in `startup`
+static void select_memory_backend()
+{
+    json_t* backend = get_setting_value("libresplit", "memory_backend");
+    if (backend != NULL && json_string_value(backend) != NULL) {
+        memory_backend_select(json_string_value(backend));
+    } else {
+        memory_backend_select("syscall");
+    }
+    if (backend != NULL) {
+        json_decref(backend);
     }
-    lua_pop(L, 1); // Remove 'mapsCacheCycles' from the stack
 }
 
-void state(lua_State* L)
+/*
+    Lua: getStats()
+    Returns a table with the counters of the auto splitter internals
+*/
+int get_stats(lua_State* L)
 {
-    call_va(L, "state", "");
+    lua_newtable(L);
+    lua_pushnumber(L, (lua_Number)memory_statistics.pointer_cache_hits);
+    lua_setfield(L, -2, "pointerCacheHits");
+    lua_pushnumber(L, (lua_Number)memory_statistics.pointer_cache_misses);
+    lua_setfield(L, -2, "pointerCacheMisses");
+    lua_pushnumber(L, (lua_Number)memory_statistics.page_snapshot_hits);
+    lua_setfield(L, -2, "pageSnapshotHits");
+    lua_pushnumber(L, (lua_Number)memory_statistics.page_snapshot_pages);
+    lua_setfield(L, -2, "pageSnapshotPages");
+    lua_pushnumber(L, (lua_Number)memory_statistics.reads);
+    lua_setfield(L, -2, "reads");
+    lua_pushnumber(L, (lua_Number)memory_statistics.read_memo_hits);
+    lua_setfield(L, -2, "readMemoHits");
+    lua_pushnumber(L, (lua_Number)skipped_callbacks);
+    lua_setfield(L, -2, "skippedCallbacks");
+    lua_pushnumber(L, gc_statistics.last_time / 1000.0);
+    lua_setfield(L, -2, "gcTime");
+    lua_pushnumber(L, gc_statistics.max_time / 1000.0);
+    lua_setfield(L, -2, "maxGcTime");
+    lua_pushnumber(L, gc_statistics.total_time / 1000.0);
+    lua_setfield(L, -2, "totalGcTime");
+    lua_pushnumber(L, (lua_Number)gc_statistics.cycles);
+    lua_setfield(L, -2, "gcCycles");
+    lua_arena* arena = lua_arena_of(L);
+    if (arena != NULL) {
+        lua_arena_usage usage = lua_arena_get_usage(arena);
+        lua_pushnumber(L, (lua_Number)usage.used);
+        lua_setfield(L, -2, "memory");
+        lua_pushnumber(L, (lua_Number)usage.peak);
+        lua_setfield(L, -2, "peakMemory");
+        lua_pushnumber(L, (lua_Number)usage.limit);
+        lua_setfield(L, -2, "memoryLimit");
+    }
+    lua_pushnumber(L, scheduler_statistics.target_period / 1000.0);
+    lua_setfield(L, -2, "targetPeriod");
+    lua_pushnumber(L, scheduler_statistics.last_period / 1000.0);
+    lua_setfield(L, -2, "lastPeriod");
+    if (scheduler_statistics.ticks > 0) {
+        lua_pushnumber(L, scheduler_statistics.min_period / 1000.0);
+        lua_setfield(L, -2, "minPeriod");
+        lua_pushnumber(L, scheduler_statistics.max_period / 1000.0);
+        lua_setfield(L, -2, "maxPeriod");
+        lua_pushnumber(L, (double)scheduler_statistics.total_period / scheduler_statistics.ticks / 1000.0);
+        lua_setfield(L, -2, "averagePeriod");
+    }
+    lua_pushnumber(L, (lua_Number)scheduler_statistics.overruns);
+    lua_setfield(L, -2, "overruns");
+    return 1;
 }
 
-void update(lua_State* L)
+static script_options save_options()
 {
-    call_va(L, "update", "");
+    return (script_options) {
+        .refresh_rate = refresh_rate,
+        .overrun_policy = overrun_policy,
+        .pointer_cache_cycles = pointer_cache_cycles,
+        .page_snapshot_enabled = page_snapshot_enabled,
+        .memory_backend = memory_backend_name(),
+    };
 }
 
-void start(lua_State* L)
+static void restore_options(const script_options* options)
 {
-    bool ret;
-    if (call_va(L, "start", ">b", &ret)) {
-        atomic_store(&call_start, ret);
-    }
-    lua_pop(L, 1); // Remove the return value from the stack
+    refresh_rate = options->refresh_rate;
+    overrun_policy = options->overrun_policy;
+    pointer_cache_cycles = options->pointer_cache_cycles;
+    page_snapshot_enabled = options->page_snapshot_enabled;
+    memory_backend_select(options->memory_backend);
 }
 
-void split(lua_State* L)
+// Memory limit of the scripts in bytes, 0 for no limit
+static size_t memory_limit_setting()
 {
-    bool ret;
-    if (call_va(L, "split", ">b", &ret)) {
-        atomic_store(&call_split, ret);
-    }
-    lua_pop(L, 1); // Remove the return value from the stack
+    json_t* setting = get_setting_value("libresplit", "auto_splitter_memory_limit");
+    size_t limit = DEFAULT_MEMORY_LIMIT;
+    if (json_is_integer(setting) && json_integer_value(setting) >= 0)
+        limit = json_integer_value(setting);
+    if (setting != NULL)
+        json_decref(setting);
+    return limit * 1024 * 1024;
 }
 
-void is_loading(lua_State* L)
+/*
+    Creates a lua_State that allocates from its own arena, capped by the
+    `auto_splitter_memory_limit` setting
+    LuaJIT builds that can't take another allocator get theirs, without a cap
+*/
+static lua_State* new_script_state()
 {
-    bool loading;
-    if (call_va(L, "isLoading", ">b", &loading)) {
-        if (loading != prev_is_loading) {
-            atomic_store(&toggle_loading, true);
-            prev_is_loading = !prev_is_loading;
-        }
+    lua_arena* arena = lua_arena_create(memory_limit_setting());
+    lua_State* L = arena != NULL ? lua_arena_newstate(arena) : NULL;
+    if (L == NULL) {
+        lua_arena_destroy(arena);
+        L = luaL_newstate();
     }
-    lua_pop(L, 1); // Remove the return value from the stack
+    return L;
 }
 
-void reset(lua_State* L)
+static void close_state(lua_State* L)
 {
-    bool shouldReset;
-    if (call_va(L, "reset", ">b", &shouldReset)) {
-        if (shouldReset)
-            atomic_store(&call_reset, true);
-    }
-    lua_pop(L, 1); // Remove the return value from the stack
+    lua_arena* arena = lua_arena_of(L);
+    lua_close(L);
+    lua_arena_destroy(arena);
 }
 
-void run_auto_splitter()
+/*
+    Runs host code that uses the Lua API of the script's state under
+    lua_cpcall. Outside of it running out of memory ends in the panic
+    function, which exits LibreSplit. Returns false if it failed, the
+    state can only be closed then
+*/
+static bool run_protected(auto_splitter_script* script, lua_CFunction function, void* data)
 {
-    lua_State* L = luaL_newstate();
+    lua_State* L = script->L;
+    if (lua_cpcall(L, function, data) == LUA_OK)
+        return true;
+    printf("Auto splitter %d failed: %s\n", current_instance->index, lua_tostring(L, -1));
+    lua_pop(L, 1); // Remove the error message from the stack
+    return false;
+}
+
+// KiB in use, counted like the arena does for its limit when the state has one
+static int memory_in_use(lua_State* L)
+{
+    lua_arena* arena = lua_arena_of(L);
+    if (arena == NULL)
+        return lua_gc(L, LUA_GCCOUNT, 0);
+    return (int)(lua_arena_get_usage(arena).used / 1024);
+}
+
+// KiB in use past which garbage is collected in one go, so the script doesn't reach its limit
+static int gc_limit(lua_State* L)
+{
+    lua_arena* arena = lua_arena_of(L);
+    size_t limit = arena != NULL ? lua_arena_get_usage(arena).limit : 0;
+    return limit != 0 ? (int)(limit / 1024 / 4 * 3) : INT_MAX;
+}
+
+// KiB in use that start the next collection cycle, see collect_garbage
+static int next_gc_threshold(auto_splitter_script* script)
+{
+    int threshold = (int)((long long)memory_in_use(script->L) * script->gc_pause / 100);
+    int limit = gc_limit(script->L);
+    return threshold < limit ? threshold : limit;
+}
+
+static void close_script(auto_splitter_script* script)
+{
+    for (int i = 0; i < CALLBACK_COUNT; i++)
+        free(script->triggers[i].inputs);
+    clear_watchers(script->L);
+    close_state(script->L);
+    script->L = NULL;
+}
+
+typedef struct script_load {
+    auto_splitter_script* script;
+    const char* path;
+    bool loaded;
+} script_load;
+
+static int protected_load(lua_State* L)
+{
+    script_load* load = lua_touserdata(L, 1);
+    auto_splitter_script* script = load->script;
     luaL_openlibs(L);
+    open_memory_ffi(L);
     disable_functions(L, disabled_functions);
     lua_pushcfunction(L, find_process_id);
     lua_setglobal(L, "process");
     lua_pushcfunction(L, read_address);
     lua_setglobal(L, "readAddress");
+    lua_pushcfunction(L, read_addresses);
+    lua_setglobal(L, "readAddresses");
     lua_pushcfunction(L, getPid);
     lua_setglobal(L, "getPID");
-
-    char current_file[PATH_MAX];
-    strcpy(current_file, auto_splitter_file);
-
-    // Load the Lua file
-    if (luaL_loadfile(L, auto_splitter_file) != LUA_OK) {
+    lua_pushcfunction(L, watch);
+    lua_setglobal(L, "watch");
+    lua_pushcfunction(L, get_stats);
+    lua_setglobal(L, "getStats");
+    lua_pushcfunction(L, sig_scan);
+    lua_setglobal(L, "sigScan");
+    lua_pushcfunction(L, get_modules);
+    lua_setglobal(L, "getModules");
+    lua_pushcfunction(L, script_require);
+    lua_setglobal(L, "require");
+
+    // Load the Lua file, or its bytecode if it didn't change since last time
+    if (script_cache_load(L, load->path) != LUA_OK) {
         // Error loading the file
         const char* error_msg = lua_tostring(L, -1);
-        lua_pop(L, 1); // Remove the error message from the stack
         fprintf(stderr, "Lua syntax error: %s\n", error_msg);
-        lua_close(L);
-        atomic_store(&auto_splitter_enabled, false);
-        return;
+        return 0;
     }
 
     // Execute the Lua file
     if (lua_pcall(L, 0, LUA_MULTRET, 0) != LUA_OK) {
         // Error executing the file
         const char* error_msg = lua_tostring(L, -1);
-        lua_pop(L, 1); // Remove the error message from the stack
         fprintf(stderr, "Lua runtime error: %s\n", error_msg);
-        lua_close(L);
-        atomic_store(&auto_splitter_enabled, false);
+        return 0;
+    }
+
+    skipped_callbacks = 0;
+    memset(&gc_statistics, 0, sizeof(gc_statistics));
+    resolve_callback_refs(script);
+    startup(script);
+    // `startup` can define or replace callbacks
+    resolve_callbacks(script);
+
+    // From now on the collector only runs between ticks, see collect_garbage
+    lua_gc(L, LUA_GCSETPAUSE, script->gc_pause);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    lua_gc(L, LUA_GCSTOP, 0);
+    script->gc_threshold = next_gc_threshold(script);
+    load->loaded = true;
+    return 0;
+}
+
+/*
+    Creates a lua_State for `path`, runs it and its `startup`
+    Returns false and leaves nothing behind if the script fails to load
+*/
+static bool load_script(auto_splitter_script* script, const char* path)
+{
+    lua_State* L = new_script_state();
+    script->L = L;
+    memset(script->triggers, 0, sizeof(script->triggers));
+    script->trigger_timeout = 0;
+    script->gc_pause = 200; // LuaJIT's default
+    script->gc_collecting = false;
+    script->memory_limit_reported = false;
+    for (int i = 0; i < CALLBACK_COUNT; i++)
+        script->callback_refs[i] = LUA_NOREF;
+    script->tick_ref = LUA_NOREF;
+
+    refresh_rate = 60;
+    overrun_policy = OVERRUN_SKIP;
+    pointer_cache_cycles = 1;
+    page_snapshot_enabled = false;
+    select_memory_backend();
+
+    script_load load = { .script = script, .path = path, .loaded = false };
+    if (!run_protected(script, protected_load, &load) || !load.loaded) {
+        close_script(script);
+        return false;
+    }
+    return true;
+}
+
+/*
+    Watches the directory of the script rather than the file itself, editors
+    often save by writing a new file and renaming it over the old one
+*/
+static int watch_script(const char* path)
+{
+    char directory[PATH_MAX];
+    snprintf(directory, sizeof(directory), "%s", path);
+    char* slash = strrchr(directory, '/');
+    if (slash == NULL)
+        return -1;
+    *slash = '\0';
+
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    if (inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Drains the pending events, returns true if one of them was about `path`
+static bool script_changed(int fd, const char* path)
+{
+    const char* name = strrchr(path, '/') + 1;
+    bool changed = false;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char* p = buffer; p < buffer + length;) {
+            struct inotify_event* event = (struct inotify_event*)p;
+            if (event->len > 0 && strcmp(event->name, name) == 0)
+                changed = true;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
+
+/*
+    Swaps in a new version of the script, called between two ticks
+    The game stays attached and the module index is kept. If the new version
+    fails to load the old one keeps running
+*/
+static void reload_script(auto_splitter_script* script, const char* path)
+{
+    script_options options = save_options();
+    auto_splitter_script reloaded;
+    if (!load_script(&reloaded, path)) {
+        printf("Couldn't reload %s, keeping the running version\n", path);
+        restore_options(&options);
         return;
     }
 
-    lua_getglobal(L, "state");
-    bool state_exists = lua_isfunction(L, -1);
-    lua_pop(L, 1); // Remove 'state' from the stack
+    close_script(script);
+    *script = reloaded;
+    memory_reset();
+    printf("Reloaded %s\n", path);
+    if (refresh_rate != options.refresh_rate || overrun_policy != options.overrun_policy)
+        scheduler_start(refresh_rate, overrun_policy);
+}
 
-    lua_getglobal(L, "start");
-    bool start_exists = lua_isfunction(L, -1);
-    lua_pop(L, 1); // Remove 'start' from the stack
+static bool setting_enabled(const char* key)
+{
+    json_t* setting = get_setting_value("libresplit", key);
+    bool enabled = json_is_true(setting);
+    if (setting != NULL)
+        json_decref(setting);
+    return enabled;
+}
 
-    lua_getglobal(L, "split");
-    bool split_exists = lua_isfunction(L, -1);
-    lua_pop(L, 1); // Remove 'split' from the stack
+// Records what the script reads into the traces directory, see trace.h
+static void start_recording(const auto_splitter_instance* instance)
+{
+    if (!setting_enabled("auto_splitter_record"))
+        return;
 
-    lua_getglobal(L, "isLoading");
-    bool is_loading_exists = lua_isfunction(L, -1);
-    lua_pop(L, 1); // Remove 'isLoading' from the stack
+    char path[PATH_MAX];
+    get_libresplit_folder_path(path);
+    strcat(path, "/traces");
+    if (mkdir(path, 0755) == -1) {
+        // Directory already exists or there was an error
+    }
 
-    lua_getglobal(L, "startup");
-    bool startup_exists = lua_isfunction(L, -1);
-    lua_pop(L, 1); // Remove 'startup' from the stack
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm local;
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime_r(&now, &local));
+    char name[64];
+    snprintf(name, sizeof(name), "/%d-%s.lstrace", instance->index, stamp);
+    strcat(path, name);
+    trace_record_start(path);
+}
 
-    lua_getglobal(L, "reset");
-    bool reset_exists = lua_isfunction(L, -1);
-    lua_pop(L, 1); // Remove 'reset' from the stack
+/*
+    Tells once per script that it ran out of memory, Lua only says
+    "not enough memory" in the error of the callback that hit the limit
+*/
+static void report_memory_limit(auto_splitter_script* script)
+{
+    lua_arena* arena = lua_arena_of(script->L);
+    if (arena == NULL || script->memory_limit_reported)
+        return;
+    lua_arena_usage usage = lua_arena_get_usage(arena);
+    if (usage.limit_hits == 0)
+        return;
+    printf("Auto splitter %d reached its memory limit of %zu MiB (auto_splitter_memory_limit)\n",
+        current_instance->index, usage.limit / 1024 / 1024);
+    script->memory_limit_reported = true;
+}
 
-    lua_getglobal(L, "update");
-    bool update_exists = lua_isfunction(L, -1);
-    lua_pop(L, 1); // Remove 'update' from the stack
+typedef struct tick_args {
+    auto_splitter_script* script;
+    long long time;
+} tick_args;
 
-    if (startup_exists) {
-        startup(L);
+static int protected_tick(lua_State* L)
+{
+    const tick_args* args = lua_touserdata(L, 1);
+    auto_splitter_script* script = args->script;
+    long long tick_time = args->time;
+    uint64_t profile_start = profiler_enabled ? profiler_now() : 0;
+    memory_tick_start();
+    update_watchers(script->L);
+    if (profiler_enabled)
+        profiler_record(PROFILE_WATCHERS, profile_start);
+    tick(script, tick_time);
+    if (profiler_enabled) {
+        profiler_record(PROFILE_TICK, profile_start);
+        profiler_tick_end(script->L);
     }
+    memory_tick_end();
+    return 0;
+}
 
-    printf("Refresh rate: %d\n", refresh_rate);
-    int rate = 1000000 / refresh_rate;
+// One tick, the watchers are updated first so the callbacks see new values
+static bool run_tick(auto_splitter_script* script, long long tick_time)
+{
+    tick_args args = { .script = script, .time = tick_time };
+    bool ok = run_protected(script, protected_tick, &args);
+    report_memory_limit(script);
+    return ok;
+}
 
-    while (1) {
-        struct timespec clock_start;
-        clock_gettime(CLOCK_MONOTONIC, &clock_start);
+/*
+    Runs the garbage collector after a tick, for at most `budget` nanoseconds
+    The collector is stopped while the script runs so it never kicks in
+    in the middle of a callback. A cycle starts once the memory in use grew
+    by `gcPause` percent since the end of the previous one, and is then
+    done a step at a time, `gcStepMul` sets the size of a step. A script
+    that allocates faster than that gets its cycle finished in one go, so
+    its memory doesn't keep growing, and so does one that gets close to its
+    memory limit
+*/
+typedef struct gc_args {
+    auto_splitter_script* script;
+    uint64_t budget;
+} gc_args;
 
-        if (!atomic_load(&auto_splitter_enabled) || strcmp(current_file, auto_splitter_file) != 0 || !process_exists() || process.pid == 0) {
+static int protected_collect_garbage(lua_State* L)
+{
+    const gc_args* args = lua_touserdata(L, 1);
+    auto_splitter_script* script = args->script;
+    uint64_t budget = args->budget;
+    int memory = memory_in_use(L);
+    gc_statistics.last_time = 0;
+    if (!script->gc_collecting && memory < script->gc_threshold)
+        return 0;
+
+    uint64_t start = profiler_now();
+    bool behind = memory >= script->gc_threshold * 2 || memory >= gc_limit(L);
+    script->gc_collecting = true;
+    do {
+        if (lua_gc(L, LUA_GCSTEP, 0)) {
+            script->gc_collecting = false;
+            script->gc_threshold = next_gc_threshold(script);
+            gc_statistics.cycles++;
             break;
         }
+    } while (behind || profiler_now() - start < budget);
+    // A step gives the collector a threshold again, it would run on its own
+    lua_gc(L, LUA_GCSTOP, 0);
+
+    uint64_t duration = profiler_now() - start;
+    gc_statistics.last_time = duration;
+    gc_statistics.total_time += duration;
+    if (duration > gc_statistics.max_time)
+        gc_statistics.max_time = duration;
+    if (profiler_enabled)
+        profiler_record(PROFILE_GC, start);
+    return 0;
+}
 
-        if (state_exists) {
-            state(L);
-        }
+// Finalizers run during the steps, they can fail like any Lua code
+static bool collect_garbage(auto_splitter_script* script, uint64_t budget)
+{
+    gc_args args = { .script = script, .budget = budget };
+    return run_protected(script, protected_collect_garbage, &args);
+}
 
-        if (update_exists) {
-            update(L);
-        }
+// Modification time of `path`, -1 if it doesn't exist
+static time_t file_mtime(const char* path)
+{
+    struct stat st;
+    if (stat(path, &st) == -1)
+        return -1;
+    return st.st_mtime;
+}
 
-        if (start_exists) {
-            start(L);
-        }
+void run_auto_splitter(auto_splitter_instance* instance)
+{
+    char current_file[PATH_MAX];
+    strcpy(current_file, auto_splitter_instance_file(instance));
+
+    /*
+        A script that failed is only tried again once it's been changed or
+        another file is picked, the other instances keep running meanwhile
+    */
+    if (instance->failed_mtime != 0 && strcmp(instance->failed_file, current_file) == 0
+        && instance->failed_mtime == file_mtime(current_file))
+        return;
 
-        if (split_exists) {
-            split(L);
-        }
+    current_instance = instance;
+    memory_reset();
+    // Known before loading, the tick function is built with the profiler's mark
+    profiler_enabled = setting_enabled("auto_splitter_profiler");
+    start_recording(instance);
+    auto_splitter_script script;
+    if (!load_script(&script, current_file)) {
+        profiler_enabled = false;
+        trace_record_stop();
+        process_detach();
+        instance->failed_mtime = file_mtime(current_file);
+        strcpy(instance->failed_file, current_file);
+        return;
+    }
+    instance->failed_mtime = 0;
+    memory_reset();
+    if (profiler_enabled)
+        profiler_start(instance->index, current_file);
 
-        if (is_loading_exists) {
-            is_loading(L);
-        }
+    printf("Auto splitter %d: %s\n", instance->index, current_file);
+    printf("Refresh rate: %d\n", refresh_rate);
+    printf("Overrun policy: %s\n", overrun_policy_name(overrun_policy));
+    printf("Memory backend: %s\n", memory_backend_name());
+    lua_arena* arena = lua_arena_of(script.L);
+    if (arena != NULL && lua_arena_get_usage(arena).limit != 0)
+        printf("Memory limit: %zu MiB\n", lua_arena_get_usage(arena).limit / 1024 / 1024);
+    else
+        printf("Memory limit: none\n");
+    scheduler_start(refresh_rate, overrun_policy);
+    int script_watch = watch_script(current_file);
+    scheduler_watch_fd(script_watch);
 
-        if (reset_exists) {
-            reset(L);
+    while (1) {
+        if (!atomic_load(&auto_splitter_enabled) || strcmp(current_file, auto_splitter_instance_file(instance)) != 0 || !process_exists() || process.pid == 0) {
+            break;
         }
 
-        // Clear the memory maps cache if needed
-        maps_cache_cycles_value--;
-        if (maps_cache_cycles_value < 1) {
-            p_maps_cache_size = 0; // We dont need to "empty" the list as the elements after index 0 are considered invalid
-            maps_cache_cycles_value = maps_cache_cycles;
-            // printf("Cleared maps cache\n");
+        long long tick_time = ls_time_now();
+        trace_record_tick(tick_time);
+        bool ok = run_tick(&script, tick_time);
+        // Half of the time left, the rest is slack for the next tick
+        uint64_t gc_budget = scheduler_time_left() / 2;
+        if (!ok || !collect_garbage(&script, gc_budget < GC_MAX_BUDGET ? gc_budget : GC_MAX_BUDGET)) {
+            // Not run again until it's saved, like a script that fails to load
+            instance->failed_mtime = file_mtime(current_file);
+            strcpy(instance->failed_file, current_file);
+            break;
         }
 
-        struct timespec clock_end;
-        clock_gettime(CLOCK_MONOTONIC, &clock_end);
-        long long duration = (clock_end.tv_sec - clock_start.tv_sec) * 1000000 + (clock_end.tv_nsec - clock_start.tv_nsec) / 1000;
-        // printf("duration: %llu\n", duration);
-        if (duration < rate) {
-            usleep(rate - duration);
+        if (script_watch != -1 && scheduler_fd_ready() && script_changed(script_watch, current_file)) {
+            reload_script(&script, current_file);
         }
+        scheduler_wait();
     }
 
-    lua_close(L);
+    scheduler_watch_fd(-1);
+    if (script_watch != -1) {
+        close(script_watch);
+    }
+    scheduler_stop();
+    profiler_stop();
+    trace_record_stop();
+    // Reloads give the script a new arena, this is the peak since the last one
+    arena = lua_arena_of(script.L);
+    if (arena != NULL)
+        printf("Auto splitter %d peak memory: %zu KiB\n", instance->index, lua_arena_get_usage(arena).peak / 1024);
+    close_script(&script);
+    process_detach();
+}
+
+/*
+    Runs the script at `path` against a trace instead of a game, as fast as
+    it can. The ticks get the times they were recorded at, `on_event` is
+    called with every event the script sends
+    Returns the number of ticks, -1 if the trace or the script didn't load
+*/
+long long replay_auto_splitter(const char* path, const char* trace_path, bool profile, void (*on_event)(const auto_splitter_event* event))
+{
+    current_instance = &auto_splitter_instances[0];
+    if (!trace_replay_open(trace_path))
+        return -1;
+
+    memory_reset();
+    profiler_enabled = profile;
+    auto_splitter_script script;
+    if (!load_script(&script, path)) {
+        profiler_enabled = false;
+        process_detach();
+        trace_replay_close();
+        return -1;
+    }
+    memory_reset();
+    if (profiler_enabled)
+        profiler_start(0, path);
+
+    long long ticks = 0;
+    long long tick_time;
+    auto_splitter_event event;
+    while (trace_replay_next_tick(&tick_time)) {
+        if (!run_tick(&script, tick_time) || !collect_garbage(&script, GC_MAX_BUDGET))
+            break;
+        ticks++;
+        while (auto_splitter_pop_event(&event))
+            on_event(&event);
+    }
+
+    profiler_stop();
+    close_script(&script);
+    process_detach();
+    trace_replay_close();
+    return ticks;
 }
@@ -3,16 +3,39 @@
 
 #include <linux/limits.h>
 #include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "event-ring.h"
+
+#define AUTO_SPLITTER_MAX_INSTANCES 8
+
+/*
+    One auto splitter, each runs its own script on its own thread and
+    attaches to its own process. Instance 0 runs `auto_splitter_file`, the
+    others run the files listed in the `auto_splitter_extra_files` setting
+*/
+typedef struct auto_splitter_instance {
+    int index;
+    char file[PATH_MAX];
+    event_ring events; // Read by the GTK thread
+    time_t failed_mtime; // Modification time of the file when it last failed to load or run, 0 if it didn't
+    char failed_file[PATH_MAX]; // The file that failed to load
+} auto_splitter_instance;
 
 extern atomic_bool auto_splitter_enabled;
-extern atomic_bool call_start;
-extern atomic_bool call_split;
-extern atomic_bool toggle_loading;
-extern atomic_bool call_reset;
 extern char auto_splitter_file[PATH_MAX];
-extern int maps_cache_cycles_value;
+extern int auto_splitter_event_fd;
+extern auto_splitter_instance auto_splitter_instances[AUTO_SPLITTER_MAX_INSTANCES];
+extern int auto_splitter_instance_count;
 
 void check_directories();
-void run_auto_splitter();
+const char* auto_splitter_instance_file(const auto_splitter_instance* instance);
+int auto_splitter_instance_index();
+void run_auto_splitter(auto_splitter_instance* instance);
+long long replay_auto_splitter(const char* path, const char* trace_path, bool profile, void (*on_event)(const auto_splitter_event* event));
+bool auto_splitter_events_init();
+void auto_splitter_instances_init();
+bool auto_splitter_pop_event(auto_splitter_event* event);
 
 #endif /* __AUTO_SPLITTER_H__ */
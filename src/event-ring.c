@@ -0,0 +1,38 @@
+#include "event-ring.h"
+
+// Called from the auto splitter thread only
+bool event_ring_push(event_ring* ring, const auto_splitter_event* event)
+{
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail == EVENT_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+    ring->events[head & (EVENT_RING_SIZE - 1)] = *event;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+// Called from the GTK thread only, gets the oldest event without removing it
+bool event_ring_peek(event_ring* ring, auto_splitter_event* event)
+{
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail)
+        return false;
+    *event = ring->events[tail & (EVENT_RING_SIZE - 1)];
+    return true;
+}
+
+// Called from the GTK thread only
+bool event_ring_pop(event_ring* ring, auto_splitter_event* event)
+{
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail)
+        return false;
+    *event = ring->events[tail & (EVENT_RING_SIZE - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef __EVENT_RING_H__
+#define __EVENT_RING_H__
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EVENT_RING_SIZE 256 // Has to be a power of 2
+
+enum auto_splitter_event_type {
+    AUTO_SPLITTER_EVENT_START,
+    AUTO_SPLITTER_EVENT_SPLIT,
+    AUTO_SPLITTER_EVENT_LOADING,
+    AUTO_SPLITTER_EVENT_RESET,
+};
+
+typedef struct auto_splitter_event {
+    enum auto_splitter_event_type type;
+    bool loading; // New loading state for AUTO_SPLITTER_EVENT_LOADING
+    long long time; // ls_time_now() when the auto splitter saw it happen
+    int instance; // Index of the auto splitter instance that sent it
+} auto_splitter_event;
+
+/*
+    Bounded single producer, single consumer queue
+    The producer only writes `head`, the consumer only writes `tail`
+*/
+typedef struct event_ring {
+    auto_splitter_event events[EVENT_RING_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+    atomic_uint dropped; // Events lost because the ring was full
+} event_ring;
+
+bool event_ring_push(event_ring* ring, const auto_splitter_event* event);
+bool event_ring_peek(event_ring* ring, auto_splitter_event* event);
+bool event_ring_pop(event_ring* ring, auto_splitter_event* event);
+
+#endif /* __EVENT_RING_H__ */
@@ -0,0 +1,303 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <lauxlib.h>
+
+#include "lua-arena.h"
+
+/*
+    Blocks up to ARENA_SMALL_MAX bytes come from chunks that each serve a
+    single size class, a freed block goes to the free list of its chunk and
+    a chunk is unmapped once it's empty. Bigger blocks get their own mapping
+    Lua always passes the size of the block it frees or resizes, so blocks
+    don't need a header, chunks are aligned to their size so a block finds
+    its chunk from its address
+*/
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_SMALL_MAX 4096
+#define ARENA_CLASS_COUNT 28
+
+// 16 bytes apart up to 128, then 4 classes per power of two
+static const uint16_t class_sizes[ARENA_CLASS_COUNT] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256,
+    320, 384, 448, 512,
+    640, 768, 896, 1024,
+    1280, 1536, 1792, 2048,
+    2560, 3072, 3584, 4096
+};
+
+typedef struct arena_chunk {
+    struct arena_chunk* previous;
+    struct arena_chunk* next;
+    void* free_list;
+    uint32_t carved; // Bytes handed out, header included
+    uint32_t live; // Blocks in use
+    int class;
+} arena_chunk;
+
+// Keeps the blocks 16 bytes aligned
+#define ARENA_CHUNK_HEADER ((sizeof(arena_chunk) + 15) & ~(size_t)15)
+
+struct lua_arena {
+    arena_chunk* partial[ARENA_CLASS_COUNT]; // Chunks with room left
+    arena_chunk* full[ARENA_CLASS_COUNT];
+    arena_chunk* spare; // Last emptied chunk, kept so a class that empties and fills again doesn't map every time
+    size_t page_size;
+    lua_arena_usage usage;
+};
+
+static int size_class(size_t size)
+{
+    if (size <= 128)
+        return (int)((size - 1) / 16);
+    int shift = 63 - __builtin_clzll(size - 1);
+    return 8 + (shift - 7) * 4 + (int)((size - 1) >> (shift - 2)) - 4;
+}
+
+static size_t round_to_pages(const lua_arena* arena, size_t size)
+{
+    return (size + arena->page_size - 1) & ~(arena->page_size - 1);
+}
+
+// Bytes a request of `size` really takes
+static size_t block_size(const lua_arena* arena, size_t size)
+{
+    return size <= ARENA_SMALL_MAX ? class_sizes[size_class(size)] : round_to_pages(arena, size);
+}
+
+static void* map_pages(size_t size)
+{
+    void* pages = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return pages != MAP_FAILED ? pages : NULL;
+}
+
+// Mapped twice as big and trimmed to an aligned chunk
+static arena_chunk* map_chunk(lua_arena* arena)
+{
+    char* pages = map_pages(ARENA_CHUNK_SIZE * 2);
+    if (pages == NULL)
+        return NULL;
+    char* chunk = (char*)(((uintptr_t)pages + ARENA_CHUNK_SIZE - 1) & ~(uintptr_t)(ARENA_CHUNK_SIZE - 1));
+    if (chunk > pages)
+        munmap(pages, chunk - pages);
+    munmap(chunk + ARENA_CHUNK_SIZE, ARENA_CHUNK_SIZE - (chunk - pages));
+    arena->usage.mapped += ARENA_CHUNK_SIZE;
+    return (arena_chunk*)chunk;
+}
+
+static void unmap_chunk(lua_arena* arena, arena_chunk* chunk)
+{
+    munmap(chunk, ARENA_CHUNK_SIZE);
+    arena->usage.mapped -= ARENA_CHUNK_SIZE;
+}
+
+static void chunk_link(arena_chunk** list, arena_chunk* chunk)
+{
+    chunk->previous = NULL;
+    chunk->next = *list;
+    if (*list != NULL)
+        (*list)->previous = chunk;
+    *list = chunk;
+}
+
+static void chunk_unlink(arena_chunk** list, arena_chunk* chunk)
+{
+    if (chunk->previous != NULL)
+        chunk->previous->next = chunk->next;
+    else
+        *list = chunk->next;
+    if (chunk->next != NULL)
+        chunk->next->previous = chunk->previous;
+}
+
+static bool chunk_has_room(const arena_chunk* chunk)
+{
+    return chunk->free_list != NULL || chunk->carved + class_sizes[chunk->class] <= ARENA_CHUNK_SIZE;
+}
+
+static void* small_alloc(lua_arena* arena, int class)
+{
+    arena_chunk* chunk = arena->partial[class];
+    if (chunk == NULL) {
+        chunk = arena->spare != NULL ? arena->spare : map_chunk(arena);
+        if (chunk == NULL)
+            return NULL;
+        arena->spare = NULL;
+        chunk->free_list = NULL;
+        chunk->carved = ARENA_CHUNK_HEADER;
+        chunk->live = 0;
+        chunk->class = class;
+        chunk_link(&arena->partial[class], chunk);
+    }
+
+    void* block = chunk->free_list;
+    if (block != NULL) {
+        chunk->free_list = *(void**)block;
+    } else {
+        block = (char*)chunk + chunk->carved;
+        chunk->carved += class_sizes[class];
+    }
+    chunk->live++;
+    if (!chunk_has_room(chunk)) {
+        chunk_unlink(&arena->partial[class], chunk);
+        chunk_link(&arena->full[class], chunk);
+    }
+    return block;
+}
+
+static void small_free(lua_arena* arena, void* block)
+{
+    arena_chunk* chunk = (arena_chunk*)((uintptr_t)block & ~(uintptr_t)(ARENA_CHUNK_SIZE - 1));
+    int class = chunk->class;
+    if (!chunk_has_room(chunk)) {
+        chunk_unlink(&arena->full[class], chunk);
+        chunk_link(&arena->partial[class], chunk);
+    }
+    *(void**)block = chunk->free_list;
+    chunk->free_list = block;
+    if (--chunk->live > 0)
+        return;
+
+    chunk_unlink(&arena->partial[class], chunk);
+    if (arena->spare == NULL)
+        arena->spare = chunk;
+    else
+        unmap_chunk(arena, chunk);
+}
+
+/*
+    The limit applies to the bytes in use rather than to the mapped ones, so
+    a script whose blocks change sizes over time doesn't reach it with
+    little in use. A block that shrinks never fails, Lua doesn't expect it to
+*/
+static void* block_alloc(lua_arena* arena, size_t size, bool enforce)
+{
+    lua_arena_usage* usage = &arena->usage;
+    size_t bytes = block_size(arena, size);
+    if (enforce && usage->limit != 0 && usage->used + bytes > usage->limit) {
+        usage->limit_hits++;
+        return NULL;
+    }
+
+    void* block;
+    if (size <= ARENA_SMALL_MAX) {
+        block = small_alloc(arena, size_class(size));
+    } else {
+        block = map_pages(bytes);
+        if (block != NULL)
+            usage->mapped += bytes;
+    }
+    if (block == NULL)
+        return NULL;
+
+    usage->used += bytes;
+    if (usage->used > usage->peak)
+        usage->peak = usage->used;
+    return block;
+}
+
+static void block_free(lua_arena* arena, void* block, size_t size)
+{
+    arena->usage.used -= block_size(arena, size);
+    if (size <= ARENA_SMALL_MAX) {
+        small_free(arena, block);
+    } else {
+        size_t pages = round_to_pages(arena, size);
+        munmap(block, pages);
+        arena->usage.mapped -= pages;
+    }
+}
+
+// lua_Alloc of the states made by lua_arena_newstate
+void* lua_arena_alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+    lua_arena* arena = ud;
+    if (nsize == 0) {
+        if (ptr != NULL)
+            block_free(arena, ptr, osize);
+        return NULL;
+    }
+    if (ptr == NULL)
+        return block_alloc(arena, nsize, true);
+    if (block_size(arena, osize) == block_size(arena, nsize))
+        return ptr;
+
+    void* block = block_alloc(arena, nsize, nsize > osize);
+    if (block == NULL)
+        return NULL;
+    memcpy(block, ptr, osize < nsize ? osize : nsize);
+    block_free(arena, ptr, osize);
+    return block;
+}
+
+// `limit` in bytes, 0 for no limit
+lua_arena* lua_arena_create(size_t limit)
+{
+    lua_arena* arena = calloc(1, sizeof(lua_arena));
+    if (arena == NULL)
+        return NULL;
+    arena->page_size = sysconf(_SC_PAGESIZE);
+    arena->usage.limit = limit;
+    return arena;
+}
+
+// Unmaps everything, the state has to be closed first
+void lua_arena_destroy(lua_arena* arena)
+{
+    if (arena == NULL)
+        return;
+    for (int class = 0; class < ARENA_CLASS_COUNT; class++) {
+        arena_chunk** lists[] = { &arena->partial[class], &arena->full[class] };
+        for (int i = 0; i < 2; i++) {
+            while (*lists[i] != NULL) {
+                arena_chunk* chunk = *lists[i];
+                chunk_unlink(lists[i], chunk);
+                unmap_chunk(arena, chunk);
+            }
+        }
+    }
+    if (arena->spare != NULL)
+        unmap_chunk(arena, arena->spare);
+    free(arena);
+}
+
+/*
+    LuaJIT exits once this returns. The auto splitter calls into the state
+    under lua_cpcall so a failed allocation doesn't end up here
+*/
+static int panic(lua_State* L)
+{
+    fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(L, -1));
+    return 0;
+}
+
+/*
+    Creates a state that allocates from `arena`
+    Returns NULL if this LuaJIT can't use another allocator, builds without
+    GC64 on x86_64 need theirs to keep everything in the low 2GB
+*/
+lua_State* lua_arena_newstate(lua_arena* arena)
+{
+    lua_State* L = lua_newstate(lua_arena_alloc, arena);
+    if (L != NULL)
+        lua_atpanic(L, panic);
+    return L;
+}
+
+// Arena of a state, NULL if it wasn't made by lua_arena_newstate
+lua_arena* lua_arena_of(lua_State* L)
+{
+    void* ud;
+    return lua_getallocf(L, &ud) == lua_arena_alloc ? ud : NULL;
+}
+
+lua_arena_usage lua_arena_get_usage(const lua_arena* arena)
+{
+    return arena->usage;
+}
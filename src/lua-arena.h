@@ -0,0 +1,32 @@
+#ifndef __LUA_ARENA_H__
+#define __LUA_ARENA_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <luajit.h>
+
+/*
+    Allocator of the auto splitter Lua states
+    Every state gets its own arena, mapped apart from the heap the UI uses,
+    with an optional cap on the memory it can take
+*/
+
+typedef struct lua_arena lua_arena;
+
+typedef struct lua_arena_usage {
+    size_t used; // Bytes in blocks handed to Lua, what the limit applies to
+    size_t peak; // Highest `used` so far
+    size_t mapped; // Bytes mapped by the arena
+    size_t limit; // 0 for no limit
+    size_t limit_hits; // Allocations refused because of the limit
+} lua_arena_usage;
+
+lua_arena* lua_arena_create(size_t limit);
+void lua_arena_destroy(lua_arena* arena);
+void* lua_arena_alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+lua_State* lua_arena_newstate(lua_arena* arena);
+lua_arena* lua_arena_of(lua_State* L);
+lua_arena_usage lua_arena_get_usage(const lua_arena* arena);
+
+#endif /* __LUA_ARENA_H__ */
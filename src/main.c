@@ -1,12 +1,15 @@
 #include <linux/limits.h>
 #include <pwd.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <glib-unix.h>
 #include <gtk/gtk.h>
 
 #include "auto-splitter.h"
@@ -131,11 +134,60 @@ static void ls_app_window_clear_game(LSAppWindow* win)
 }
 
 // Forward declarations
-static void timer_start(LSAppWindow* win);
-static void timer_stop(LSAppWindow* win);
-static void timer_split(LSAppWindow* win);
+static void timer_start(LSAppWindow* win, long long time);
+static void timer_stop(LSAppWindow* win, long long time);
+static void timer_split(LSAppWindow* win, long long time);
 static void timer_reset(LSAppWindow* win);
 
+/*
+    Applies the events queued by the auto splitter thread at the time they
+    happened, so a late wakeup of the GTK thread doesn't end up in the splits
+*/
+static void ls_app_window_apply_auto_splitter_events(LSAppWindow* win)
+{
+    auto_splitter_event event;
+    while (auto_splitter_pop_event(&event)) {
+        if (!win->timer || !atomic_load(&auto_splitter_enabled))
+            continue;
+        long long now = ls_time_now();
+        long long time = event.time < now ? event.time : now;
+
+        switch (event.type) {
+        case AUTO_SPLITTER_EVENT_START:
+            if (!win->timer->loading)
+                timer_start(win, time);
+            break;
+        case AUTO_SPLITTER_EVENT_SPLIT:
+            timer_split(win, time);
+            break;
+        case AUTO_SPLITTER_EVENT_LOADING:
+            win->timer->loading = event.loading;
+            if (win->timer->running && win->timer->loading) {
+                timer_stop(win, time);
+            } else if (win->timer->started && !win->timer->running && !win->timer->loading) {
+                timer_start(win, time);
+            }
+            break;
+        case AUTO_SPLITTER_EVENT_RESET:
+            timer_reset(win);
+            break;
+        }
+
+        ls_timer_step(win->timer, now);
+    }
+}
+
+static gboolean ls_app_window_auto_splitter_events(gint fd, GIOCondition condition, gpointer data)
+{
+    LSAppWindow* win = data;
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) == -1) {
+        // Nothing to clear, still drain the ring below
+    }
+    ls_app_window_apply_auto_splitter_events(win);
+    return G_SOURCE_CONTINUE;
+}
+
 static gboolean ls_app_window_step(gpointer data)
 {
     LSAppWindow* win = data;
@@ -149,32 +201,11 @@ static gboolean ls_app_window_step(gpointer data)
             set_cursor = 1;
         }
     }
+    // Without the event fd nothing wakes us up for the events, poll them
+    if (auto_splitter_event_fd == -1)
+        ls_app_window_apply_auto_splitter_events(win);
     if (win->timer) {
         ls_timer_step(win->timer, now);
-
-        if (atomic_load(&auto_splitter_enabled)) {
-            if (atomic_load(&call_start) && !win->timer->loading) {
-                timer_start(win);
-                atomic_store(&call_start, 0);
-            }
-            if (atomic_load(&call_split)) {
-                timer_split(win);
-                atomic_store(&call_split, 0);
-            }
-            if (atomic_load(&toggle_loading)) {
-                win->timer->loading = !win->timer->loading;
-                if (win->timer->running && win->timer->loading) {
-                    timer_stop(win);
-                } else if (win->timer->started && !win->timer->running && !win->timer->loading) {
-                    timer_start(win);
-                }
-                atomic_store(&toggle_loading, 0);
-            }
-            if (atomic_load(&call_reset)) {
-                timer_reset(win);
-                atomic_store(&call_reset, 0);
-            }
-        }
     }
 
     return TRUE;
@@ -273,16 +304,16 @@ static gboolean ls_app_window_resize(GtkWidget* widget,
     return FALSE;
 }
 
-static void timer_start_split(LSAppWindow* win)
+static void timer_start_split(LSAppWindow* win, long long time)
 {
     if (win->timer) {
         GList* l;
         if (!win->timer->running) {
-            if (ls_timer_start(win->timer)) {
+            if (ls_timer_start_at(win->timer, time)) {
                 save_game(win->game);
             }
         } else {
-            ls_timer_split(win->timer);
+            ls_timer_split_at(win->timer, time);
         }
         for (l = win->components; l != NULL; l = l->next) {
             LSComponent* component = l->data;
@@ -293,12 +324,12 @@ static void timer_start_split(LSAppWindow* win)
     }
 }
 
-static void timer_start(LSAppWindow* win)
+static void timer_start(LSAppWindow* win, long long time)
 {
     if (win->timer) {
         GList* l;
         if (!win->timer->running) {
-            if (ls_timer_start(win->timer)) {
+            if (ls_timer_start_at(win->timer, time)) {
                 save_game(win->game);
             }
             for (l = win->components; l != NULL; l = l->next) {
@@ -311,12 +342,12 @@ static void timer_start(LSAppWindow* win)
     }
 }
 
-static void timer_split(LSAppWindow* win)
+static void timer_split(LSAppWindow* win, long long time)
 {
     if (win->timer) {
         GList* l;
         if (win->timer->running) {
-            ls_timer_split(win->timer);
+            ls_timer_split_at(win->timer, time);
             for (l = win->components; l != NULL; l = l->next) {
                 LSComponent* component = l->data;
                 if (component->ops->start_split) {
@@ -327,12 +358,12 @@ static void timer_split(LSAppWindow* win)
     }
 }
 
-static void timer_stop(LSAppWindow* win)
+static void timer_stop(LSAppWindow* win, long long time)
 {
     if (win->timer) {
         GList* l;
         if (win->timer->running) {
-            ls_timer_stop(win->timer);
+            ls_timer_pause_at(win->timer, time);
         }
         for (l = win->components; l != NULL; l = l->next) {
             LSComponent* component = l->data;
@@ -343,12 +374,12 @@ static void timer_stop(LSAppWindow* win)
     }
 }
 
-static void timer_stop_reset(LSAppWindow* win)
+static void timer_stop_reset(LSAppWindow* win, long long time)
 {
     if (win->timer) {
         GList* l;
         if (win->timer->running) {
-            ls_timer_stop(win->timer);
+            ls_timer_pause_at(win->timer, time);
         } else {
             if (ls_timer_reset(win->timer)) {
                 ls_app_window_clear_game(win);
@@ -446,12 +477,12 @@ static void toggle_decorations(LSAppWindow* win)
 
 static void keybind_start_split(GtkWidget* widget, LSAppWindow* win)
 {
-    timer_start_split(win);
+    timer_start_split(win, ls_time_now());
 }
 
 static void keybind_stop_reset(const char* str, LSAppWindow* win)
 {
-    timer_stop_reset(win);
+    timer_stop_reset(win, ls_time_now());
 }
 
 static void keybind_cancel(const char* str, LSAppWindow* win)
@@ -479,10 +510,11 @@ static gboolean ls_app_window_keypress(GtkWidget* widget,
     gpointer data)
 {
     LSAppWindow* win = (LSAppWindow*)data;
+    long long now = ls_time_now();
     if (keybind_match(win->keybind_start_split, event->key)) {
-        timer_start_split(win);
+        timer_start_split(win, now);
     } else if (keybind_match(win->keybind_stop_reset, event->key)) {
-        timer_stop_reset(win);
+        timer_stop_reset(win, now);
     } else if (keybind_match(win->keybind_cancel, event->key)) {
         timer_cancel_run(win);
     } else if (keybind_match(win->keybind_unsplit, event->key)) {
@@ -649,6 +681,8 @@ static void ls_app_window_init(LSAppWindow* win)
     gtk_widget_show(win->footer);
 
     g_timeout_add(1, ls_app_window_step, win);
+    if (auto_splitter_event_fd != -1)
+        g_unix_fd_add(auto_splitter_event_fd, G_IO_IN, ls_app_window_auto_splitter_events, win);
     g_timeout_add((int)(1000 / 30.), ls_app_window_draw, win);
 }
 
@@ -1021,11 +1055,12 @@ static void ls_app_class_init(LSAppClass* class)
     G_APPLICATION_CLASS(class)->open = ls_app_open;
 }
 
-static void* ls_auto_splitter()
+static void* ls_auto_splitter(void* data)
 {
+    auto_splitter_instance* instance = data;
     while (1) {
-        if (atomic_load(&auto_splitter_enabled) && auto_splitter_file[0] != '\0') {
-            run_auto_splitter();
+        if (atomic_load(&auto_splitter_enabled) && auto_splitter_instance_file(instance)[0] != '\0') {
+            run_auto_splitter(instance);
         }
         if (atomic_load(&exit_requested))
             return 0;
@@ -1038,10 +1073,16 @@ int main(int argc, char* argv[])
 {
     check_directories();
 
-    pthread_t t1;
-    pthread_create(&t1, NULL, &ls_auto_splitter, NULL);
+    if (!auto_splitter_events_init())
+        printf("Failed to create the auto splitter event fd\n");
+    auto_splitter_instances_init();
+
+    pthread_t threads[AUTO_SPLITTER_MAX_INSTANCES];
+    for (int i = 0; i < auto_splitter_instance_count; i++)
+        pthread_create(&threads[i], NULL, &ls_auto_splitter, &auto_splitter_instances[i]);
     g_application_run(G_APPLICATION(ls_app_new()), argc, argv);
-    pthread_join(t1, NULL);
+    for (int i = 0; i < auto_splitter_instance_count; i++)
+        pthread_join(threads[i], NULL);
 
     return 0;
 }
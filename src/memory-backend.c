@@ -0,0 +1,427 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "memory-backend.h"
+
+#define MEMORY_MAX_IOVECS 1024 // UIO_MAXIOV, the kernel's limit per process_vm_readv call
+#define IO_URING_ENTRIES 256
+
+ssize_t process_vm_readv(int pid, struct iovec* mem_local, int liovcnt, struct iovec* mem_remote, int riovcnt, int flags);
+
+_Thread_local uint64_t memory_backend_syscalls = 0;
+
+static _Thread_local const memory_backend* active_backend = NULL;
+static _Thread_local int attached_pid = 0;
+
+// Replaces the selected backend whatever the script asks for, NULL if none
+static _Thread_local const memory_backend* override_backend = NULL;
+static _Thread_local memory_backend_observer read_observer = NULL;
+
+/*
+    process_vm_readv backend
+    process_vm_readv stops at the first remote iovec it can't read, so the
+    remaining ones are submitted again after marking the faulting one
+*/
+static _Thread_local int syscall_pid = 0;
+
+static bool syscall_attach(int pid)
+{
+    syscall_pid = pid;
+    return true;
+}
+
+static void syscall_detach()
+{
+    syscall_pid = 0;
+}
+
+static void syscall_read(struct iovec* local, struct iovec* remote, int32_t* errors, int count)
+{
+    int i = 0;
+    while (i < count) {
+        int n = count - i < MEMORY_MAX_IOVECS ? count - i : MEMORY_MAX_IOVECS;
+        ssize_t mem_n_read = process_vm_readv(syscall_pid, local + i, n, remote + i, n, 0);
+        memory_backend_syscalls++;
+        if (mem_n_read == -1) {
+            int32_t err = (int32_t)errno;
+            if (err == ESRCH || err == EPERM) {
+                // Nothing else is going to succeed either
+                for (; i < count; i++)
+                    errors[i] = err;
+                return;
+            }
+            errors[i++] = err;
+            continue;
+        }
+
+        int done = 0;
+        while (done < n && mem_n_read >= (ssize_t)remote[i + done].iov_len) {
+            mem_n_read -= remote[i + done].iov_len;
+            errors[i + done] = 0;
+            done++;
+        }
+        if (done < n) {
+            errors[i + done] = EFAULT;
+            done++;
+        }
+        i += done;
+    }
+}
+
+static const memory_backend syscall_backend = {
+    "syscall",
+    syscall_attach,
+    syscall_detach,
+    syscall_read,
+};
+
+/*
+    /proc/<pid>/mem backend
+    The file stays open for the whole attachment, every iovec is one pread
+*/
+static _Thread_local int proc_mem_fd = -1;
+
+static int open_proc_mem(int pid)
+{
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/mem", pid);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+// Reading unmapped memory through /proc/<pid>/mem fails with EIO
+static int32_t proc_mem_error(int32_t err)
+{
+    return err == EIO ? EFAULT : err;
+}
+
+static bool proc_mem_attach(int pid)
+{
+    proc_mem_fd = open_proc_mem(pid);
+    return proc_mem_fd != -1;
+}
+
+static void proc_mem_detach()
+{
+    if (proc_mem_fd != -1)
+        close(proc_mem_fd);
+    proc_mem_fd = -1;
+}
+
+// One pread per iovec, also what io_uring falls back to
+static void pread_iovecs(int fd, struct iovec* local, struct iovec* remote, int32_t* errors, int count)
+{
+    for (int i = 0; i < count; i++) {
+        ssize_t mem_n_read = pread(fd, local[i].iov_base, local[i].iov_len, (off_t)(uintptr_t)remote[i].iov_base);
+        memory_backend_syscalls++;
+        if (mem_n_read == -1)
+            errors[i] = proc_mem_error((int32_t)errno);
+        else if (mem_n_read != (ssize_t)local[i].iov_len)
+            errors[i] = EFAULT;
+        else
+            errors[i] = 0;
+    }
+}
+
+static void proc_mem_read(struct iovec* local, struct iovec* remote, int32_t* errors, int count)
+{
+    pread_iovecs(proc_mem_fd, local, remote, errors, count);
+}
+
+static const memory_backend proc_mem_backend = {
+    "procmem",
+    proc_mem_attach,
+    proc_mem_detach,
+    proc_mem_read,
+};
+
+/*
+    io_uring backend
+    Reads from the same /proc/<pid>/mem file, but a whole batch of iovecs is
+    queued as reads and submitted with a single io_uring_enter
+    If io_uring_enter fails the ring is torn down and the file is read with
+    pread until the next attach
+*/
+static _Thread_local struct {
+    int fd;
+    int mem_fd;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    uint32_t generation; // Of the current batch, in the upper half of user_data
+} ring = { .fd = -1, .mem_fd = -1 };
+
+// Closes the ring but keeps /proc/<pid>/mem open
+static void io_uring_close_ring()
+{
+    if (ring.sqes != NULL && ring.sqes != MAP_FAILED)
+        munmap(ring.sqes, ring.sqes_size);
+    if (ring.cq_ring != NULL && ring.cq_ring != MAP_FAILED && ring.cq_ring != ring.sq_ring)
+        munmap(ring.cq_ring, ring.cq_ring_size);
+    if (ring.sq_ring != NULL && ring.sq_ring != MAP_FAILED)
+        munmap(ring.sq_ring, ring.sq_ring_size);
+    if (ring.fd != -1)
+        close(ring.fd);
+    int mem_fd = ring.mem_fd;
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+    ring.mem_fd = mem_fd;
+}
+
+static void io_uring_detach()
+{
+    io_uring_close_ring();
+    if (ring.mem_fd != -1)
+        close(ring.mem_fd);
+    ring.mem_fd = -1;
+}
+
+static bool io_uring_attach(int pid)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring.mem_fd = open_proc_mem(pid);
+    if (ring.mem_fd == -1)
+        return false;
+
+    ring.fd = (int)syscall(__NR_io_uring_setup, IO_URING_ENTRIES, &params);
+    if (ring.fd == -1) {
+        io_uring_detach();
+        return false;
+    }
+
+    ring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring.cq_ring_size > ring.sq_ring_size)
+            ring.sq_ring_size = ring.cq_ring_size;
+        ring.cq_ring_size = ring.sq_ring_size;
+    }
+
+    ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sq_ring == MAP_FAILED) {
+        io_uring_detach();
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring.cq_ring = ring.sq_ring;
+    } else {
+        ring.cq_ring = mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if (ring.cq_ring == MAP_FAILED) {
+            io_uring_detach();
+            return false;
+        }
+    }
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring.sqes = mmap(NULL, ring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) {
+        io_uring_detach();
+        return false;
+    }
+
+    uint8_t* sq = ring.sq_ring;
+    uint8_t* cq = ring.cq_ring;
+    ring.sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring.sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring.sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring.cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring.cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring.cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+// Reads the completions of the current batch into `errors`, returns how many there were
+static int io_uring_reap(struct iovec* local, int32_t* errors, bool* done, int first, int n)
+{
+    int completed = 0;
+    unsigned head = *ring.cq_head;
+    unsigned cq_tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != cq_tail; head++) {
+        struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+        if ((uint32_t)(cqe->user_data >> 32) != ring.generation)
+            continue; // Left over from an earlier batch
+        int j = (int)(uint32_t)cqe->user_data;
+        if (j < first || j >= first + n || done[j - first])
+            continue;
+        if (cqe->res < 0)
+            errors[j] = proc_mem_error(-cqe->res);
+        else if ((size_t)cqe->res != local[j].iov_len)
+            errors[j] = EFAULT;
+        else
+            errors[j] = 0;
+        done[j - first] = true;
+        completed++;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    return completed;
+}
+
+static void io_uring_read(struct iovec* local, struct iovec* remote, int32_t* errors, int count)
+{
+    int i = 0;
+    while (i < count && ring.fd != -1) {
+        int n = count - i < IO_URING_ENTRIES ? count - i : IO_URING_ENTRIES;
+        bool done[IO_URING_ENTRIES] = { false };
+        ring.generation++;
+
+        unsigned tail = *ring.sq_tail;
+        for (int j = 0; j < n; j++) {
+            unsigned index = (tail + j) & *ring.sq_mask;
+            struct io_uring_sqe* sqe = &ring.sqes[index];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = ring.mem_fd;
+            sqe->addr = (uint64_t)(uintptr_t)local[i + j].iov_base;
+            sqe->len = local[i + j].iov_len;
+            sqe->off = (uint64_t)(uintptr_t)remote[i + j].iov_base;
+            sqe->user_data = (uint64_t)ring.generation << 32 | (uint32_t)(i + j);
+            ring.sq_array[index] = index;
+        }
+        __atomic_store_n(ring.sq_tail, tail + n, __ATOMIC_RELEASE);
+
+        int to_submit = n;
+        int completed = 0;
+        while (completed < n) {
+            int submitted = (int)syscall(__NR_io_uring_enter, ring.fd, to_submit, n - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+            memory_backend_syscalls++;
+            if (submitted == -1) {
+                if (errno == EINTR)
+                    continue;
+                int err = errno;
+                // The reads in flight still write into `local`, wait for them
+                while (completed < n - to_submit) {
+                    int waited = (int)syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+                    memory_backend_syscalls++;
+                    if (waited == -1 && errno != EINTR)
+                        break;
+                    completed += io_uring_reap(local, errors, done, i, n);
+                }
+                printf("io_uring_enter failed: %s, reading with pread instead\n", strerror(err));
+                io_uring_close_ring();
+                for (int j = 0; j < n; j++) {
+                    if (!done[j])
+                        pread_iovecs(ring.mem_fd, &local[i + j], &remote[i + j], &errors[i + j], 1);
+                }
+                break;
+            }
+            to_submit -= submitted;
+            completed += io_uring_reap(local, errors, done, i, n);
+        }
+        i += n;
+    }
+    if (i < count)
+        pread_iovecs(ring.mem_fd, local + i, remote + i, errors + i, count - i);
+}
+
+static const memory_backend io_uring_backend = {
+    "io_uring",
+    io_uring_attach,
+    io_uring_detach,
+    io_uring_read,
+};
+
+const memory_backend* memory_backends[] = {
+    &syscall_backend,
+    &proc_mem_backend,
+    &io_uring_backend,
+    NULL,
+};
+
+/*
+    Switches to the backend called `name`
+    Returns false and keeps the current backend if there is no such backend
+*/
+bool memory_backend_select(const char* name)
+{
+    for (int i = 0; memory_backends[i] != NULL; i++) {
+        if (strcmp(memory_backends[i]->name, name) != 0)
+            continue;
+        if (active_backend != memory_backends[i]) {
+            memory_backend_detach();
+            active_backend = memory_backends[i];
+        }
+        return true;
+    }
+    printf("Unknown memory backend: %s\n", name);
+    return false;
+}
+
+const char* memory_backend_name()
+{
+    return active_backend != NULL ? active_backend->name : syscall_backend.name;
+}
+
+/*
+    Reads from process `pid` with the selected backend
+    Backends attach lazily, if attaching fails the syscall backend is used
+*/
+void memory_backend_read(int pid, struct iovec* local, struct iovec* remote, int32_t* errors, int count)
+{
+    if (count <= 0)
+        return;
+
+    if (active_backend == NULL)
+        active_backend = &syscall_backend;
+    const memory_backend* backend = override_backend != NULL ? override_backend : active_backend;
+
+    if (attached_pid != pid) {
+        memory_backend_detach();
+        if (backend == override_backend) {
+            backend->attach(pid);
+        } else if (!active_backend->attach(pid)) {
+            printf("Couldn't attach the %s memory backend to %d: %s, falling back to %s\n",
+                active_backend->name, pid, strerror(errno), syscall_backend.name);
+            active_backend = &syscall_backend;
+            active_backend->attach(pid);
+            backend = active_backend;
+        }
+        attached_pid = pid;
+    }
+
+    backend->read(local, remote, errors, count);
+    if (read_observer != NULL)
+        read_observer(local, remote, errors, count);
+}
+
+void memory_backend_detach()
+{
+    if (override_backend != NULL && attached_pid != 0)
+        override_backend->detach();
+    else if (active_backend != NULL && attached_pid != 0)
+        active_backend->detach();
+    attached_pid = 0;
+}
+
+// Makes every read of this thread go through `backend`, NULL to go back to the selected one
+void memory_backend_override(const memory_backend* backend)
+{
+    memory_backend_detach();
+    override_backend = backend;
+}
+
+void memory_backend_observe(memory_backend_observer observer)
+{
+    read_observer = observer;
+}
@@ -0,0 +1,36 @@
+#ifndef __MEMORY_BACKEND_H__
+#define __MEMORY_BACKEND_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+    A way of reading the memory of another process
+    `read` reads every local/remote iovec pair and stores the errno of each
+    pair in `errors`, 0 meaning the pair was read completely
+*/
+typedef struct memory_backend {
+    const char* name;
+    bool (*attach)(int pid);
+    void (*detach)();
+    void (*read)(struct iovec* local, struct iovec* remote, int32_t* errors, int count);
+} memory_backend;
+
+// A NULL-terminated array of all available backends
+extern const memory_backend* memory_backends[];
+
+// System calls made by the backends on this thread, for the profiler
+extern _Thread_local uint64_t memory_backend_syscalls;
+
+// Called after every read with its results, used to record traces
+typedef void (*memory_backend_observer)(const struct iovec* local, const struct iovec* remote, const int32_t* errors, int count);
+
+bool memory_backend_select(const char* name);
+const char* memory_backend_name();
+void memory_backend_read(int pid, struct iovec* local, struct iovec* remote, int32_t* errors, int count);
+void memory_backend_detach();
+void memory_backend_override(const memory_backend* backend);
+void memory_backend_observe(memory_backend_observer observer);
+
+#endif /* __MEMORY_BACKEND_H__ */
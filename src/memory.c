@@ -6,37 +6,261 @@
 #include <string.h>
 #include <sys/uio.h>
 
+#include <lauxlib.h>
 #include <luajit.h>
+#include <lualib.h>
 
+#include "memory-backend.h"
 #include "memory.h"
 #include "process.h"
 
-bool memory_error;
-extern game_process process;
-
-#define READ_MEMORY_FUNCTION(value_type)                                                         \
-    value_type read_memory_##value_type(uint64_t mem_address, int32_t* err)                      \
-    {                                                                                            \
-        value_type value;                                                                        \
-                                                                                                 \
-        struct iovec mem_local;                                                                  \
-        struct iovec mem_remote;                                                                 \
-                                                                                                 \
-        mem_local.iov_base = &value;                                                             \
-        mem_local.iov_len = sizeof(value);                                                       \
-        mem_remote.iov_len = sizeof(value);                                                      \
-        mem_remote.iov_base = (void*)(uintptr_t)mem_address;                                     \
-                                                                                                 \
-        ssize_t mem_n_read = process_vm_readv(process.pid, &mem_local, 1, &mem_remote, 1, 0);    \
-        if (mem_n_read == -1) {                                                                  \
-            *err = (int32_t)errno;                                                               \
-            memory_error = true;                                                                 \
-        } else if (mem_n_read != (ssize_t)mem_remote.iov_len) {                                  \
-            printf("Error reading process memory: short read of %ld bytes\n", (long)mem_n_read); \
-            exit(1);                                                                             \
-        }                                                                                        \
-                                                                                                 \
-        return value;                                                                            \
+#define PAGE_SNAPSHOT_SIZE 4096
+#define PAGE_SNAPSHOT_MAX_PAGES 64
+
+#define POINTER_CACHE_SIZE 512 // Must be a power of 2
+#define POINTER_CACHE_MAX_ROOTS 64
+
+#define READ_MEMO_SIZE 256 // Must be a power of 2
+
+_Thread_local bool memory_error;
+extern _Thread_local game_process process;
+
+_Thread_local memory_stats memory_statistics;
+_Thread_local int pointer_cache_cycles = 1; // 0=off, 1=current cycle, +1=multiple cycles validated by their root pointer
+static _Thread_local int pointer_cache_cycles_value = 1;
+
+/*
+    Resolved pointer path prefixes
+    An entry is keyed by the start of the path (module base + first offset)
+    and the offsets of the first `depth` hops, `address` is where those hops
+    lead to. Entries only count when their generation is the current one, so
+    the whole cache is flushed by bumping `pointer_cache_generation`
+*/
+typedef struct pointer_cache_entry {
+    uint32_t generation;
+    uint32_t tick; // Last tick the entry was known to be valid
+    int depth;
+    uint64_t start;
+    uint64_t root; // Pointer stored at `start`, used to validate entries from older ticks
+    uint64_t address;
+    int64_t offsets[MEMORY_MAX_OFFSETS];
+} pointer_cache_entry;
+
+_Thread_local bool page_snapshot_enabled = false;
+
+/*
+    Pages of the game's memory copied during the current tick
+    A page that couldn't be read is kept with its error so it isn't retried
+*/
+typedef struct page_snapshot {
+    uint64_t page;
+    int32_t error;
+    uint8_t data[PAGE_SNAPSHOT_SIZE];
+} page_snapshot;
+
+static _Thread_local page_snapshot* page_snapshots = NULL;
+static _Thread_local int page_snapshot_count = 0;
+
+/*
+    Results of the readAddress calls of the current tick
+    A call with the same type, path start and offsets as an earlier one in
+    the same tick gets the same value without reading the game again. Only
+    used during a tick, see memory_tick_active
+*/
+typedef struct read_memo_entry {
+    uint32_t generation;
+    enum memory_type type;
+    int string_size;
+    int offset_count;
+    uint64_t start;
+    int64_t offsets[MEMORY_MAX_OFFSETS];
+    bool error;
+    int result_type; // LUA_TNUMBER, LUA_TBOOLEAN or LUA_TSTRING
+    lua_Number number;
+    char* string;
+} read_memo_entry;
+
+static _Thread_local read_memo_entry* read_memo = NULL;
+static _Thread_local uint32_t read_memo_generation = 1;
+static _Thread_local uint32_t read_memo_size = 0;
+
+static _Thread_local pointer_cache_entry pointer_cache[POINTER_CACHE_SIZE];
+static _Thread_local uint32_t pointer_cache_generation = 1;
+static _Thread_local uint32_t pointer_cache_size = 0;
+static _Thread_local uint32_t memory_tick = 1;
+/*
+    Set between memory_tick_start and memory_tick_end. The memo, the pointer
+    cache and the page snapshot are only used then, so a script waiting on a
+    value in `startup` still sees it change
+*/
+static _Thread_local bool memory_tick_active = false;
+
+// Roots that were already checked this tick
+static _Thread_local struct {
+    uint64_t start;
+    uint64_t root;
+} validated_roots[POINTER_CACHE_MAX_ROOTS];
+static _Thread_local int validated_root_count = 0;
+
+/*
+    Reads through the selected backend
+    Faults are reported to the module index so it notices remapped modules
+*/
+static void backend_read(struct iovec* local, struct iovec* remote, int32_t* errors, int count)
+{
+    memory_backend_read(process.pid, local, remote, errors, count);
+    for (int i = 0; i < count; i++) {
+        if (errors[i] == EFAULT)
+            process_note_fault((uintptr_t)remote[i].iov_base);
+    }
+}
+
+static const char* memory_type_names[] = {
+    "sbyte",
+    "byte",
+    "short",
+    "ushort",
+    "int",
+    "uint",
+    "long",
+    "ulong",
+    "float",
+    "double",
+    "bool",
+};
+
+static const size_t memory_type_sizes[] = {
+    sizeof(int8_t),
+    sizeof(uint8_t),
+    sizeof(int16_t),
+    sizeof(uint16_t),
+    sizeof(int32_t),
+    sizeof(uint32_t),
+    sizeof(int64_t),
+    sizeof(uint64_t),
+    sizeof(float),
+    sizeof(double),
+    sizeof(bool),
+};
+
+static page_snapshot* find_page_snapshot(uint64_t page)
+{
+    for (int i = page_snapshot_count - 1; i >= 0; i--) {
+        if (page_snapshots[i].page == page)
+            return &page_snapshots[i];
+    }
+    return NULL;
+}
+
+/*
+    Copies every page in [pages, pages + count) that isn't in the snapshot yet
+    All missing pages are fetched with a single read
+    Returns false if the snapshot has no room left for them
+*/
+static bool load_page_snapshots(const uint64_t* pages, int count)
+{
+    if (page_snapshots == NULL) {
+        page_snapshots = malloc(PAGE_SNAPSHOT_MAX_PAGES * sizeof(page_snapshot));
+        if (page_snapshots == NULL)
+            return false;
+    }
+
+    struct iovec local[PAGE_SNAPSHOT_MAX_PAGES];
+    struct iovec remote[PAGE_SNAPSHOT_MAX_PAGES];
+    int32_t errors[PAGE_SNAPSHOT_MAX_PAGES];
+    int first = page_snapshot_count;
+    int n = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (find_page_snapshot(pages[i]) != NULL)
+            continue;
+        if (page_snapshot_count == PAGE_SNAPSHOT_MAX_PAGES) {
+            page_snapshot_count = first;
+            return false;
+        }
+        page_snapshot* snapshot = &page_snapshots[page_snapshot_count++];
+        snapshot->page = pages[i];
+        local[n].iov_base = snapshot->data;
+        local[n].iov_len = PAGE_SNAPSHOT_SIZE;
+        remote[n].iov_base = (void*)(uintptr_t)pages[i];
+        remote[n].iov_len = PAGE_SNAPSHOT_SIZE;
+        n++;
+    }
+    if (n == 0)
+        return true;
+
+    backend_read(local, remote, errors, n);
+    for (int i = 0; i < n; i++)
+        page_snapshots[first + i].error = errors[i];
+    memory_statistics.page_snapshot_pages += n;
+    return true;
+}
+
+/*
+    Serves a read from the page snapshot, loading the pages it touches first
+    Returns false if the read has to go to the game directly instead
+*/
+static bool read_page_snapshot(uint64_t address, void* buffer, size_t size, int32_t* err)
+{
+    if (!memory_tick_active)
+        return false;
+    uint64_t first_page = address & ~(uint64_t)(PAGE_SNAPSHOT_SIZE - 1);
+    uint64_t last_page = (address + size - 1) & ~(uint64_t)(PAGE_SNAPSHOT_SIZE - 1);
+    uint64_t pages[PAGE_SNAPSHOT_MAX_PAGES];
+    int count = 0;
+
+    if (size == 0 || last_page < first_page)
+        return false;
+    for (uint64_t page = first_page; page <= last_page; page += PAGE_SNAPSHOT_SIZE) {
+        if (count == PAGE_SNAPSHOT_MAX_PAGES)
+            return false;
+        pages[count++] = page;
+    }
+    if (!load_page_snapshots(pages, count))
+        return false;
+
+    uint8_t* out = buffer;
+    for (int i = 0; i < count; i++) {
+        page_snapshot* snapshot = find_page_snapshot(pages[i]);
+        if (snapshot->error) {
+            *err = snapshot->error;
+            memory_error = true;
+            memset(buffer, 0, size);
+            return true;
+        }
+        uint64_t from = i == 0 ? address : pages[i];
+        uint64_t to = i == count - 1 ? address + size : pages[i] + PAGE_SNAPSHOT_SIZE;
+        memcpy(out, snapshot->data + (from - pages[i]), to - from);
+        out += to - from;
+    }
+    memory_statistics.page_snapshot_hits++;
+    return true;
+}
+
+#define READ_MEMORY_FUNCTION(value_type)                                                          \
+    value_type read_memory_##value_type(uint64_t mem_address, int32_t* err)                       \
+    {                                                                                             \
+        value_type value;                                                                         \
+                                                                                                  \
+        if (page_snapshot_enabled && read_page_snapshot(mem_address, &value, sizeof(value), err)) \
+            return value;                                                                         \
+                                                                                                  \
+        struct iovec mem_local;                                                                   \
+        struct iovec mem_remote;                                                                  \
+        int32_t mem_error;                                                                        \
+                                                                                                  \
+        mem_local.iov_base = &value;                                                              \
+        mem_local.iov_len = sizeof(value);                                                        \
+        mem_remote.iov_len = sizeof(value);                                                       \
+        mem_remote.iov_base = (void*)(uintptr_t)mem_address;                                      \
+                                                                                                  \
+        backend_read(&mem_local, &mem_remote, &mem_error, 1);                                 \
+        if (mem_error) {                                                                          \
+            *err = mem_error;                                                                     \
+            memory_error = true;                                                                  \
+        }                                                                                         \
+                                                                                                  \
+        return value;                                                                             \
     }
 
 READ_MEMORY_FUNCTION(int8_t)
@@ -59,20 +283,27 @@ char* read_memory_string(uint64_t mem_address, int buffer_size)
         return NULL;
     }
 
+    int32_t err = 0;
+    bool previous_error = memory_error;
+    if (page_snapshot_enabled && read_page_snapshot(mem_address, buffer, buffer_size, &err)) {
+        memory_error = previous_error;
+        if (err)
+            buffer[0] = '\0';
+        return buffer;
+    }
+
     struct iovec mem_local;
     struct iovec mem_remote;
+    int32_t mem_error;
 
     mem_local.iov_base = buffer;
     mem_local.iov_len = buffer_size;
     mem_remote.iov_len = buffer_size;
     mem_remote.iov_base = (void*)(uintptr_t)mem_address;
 
-    ssize_t mem_n_read = process_vm_readv(process.pid, &mem_local, 1, &mem_remote, 1, 0);
-    if (mem_n_read == -1) {
+    backend_read(&mem_local, &mem_remote, &mem_error, 1);
+    if (mem_error) {
         buffer[0] = '\0';
-    } else if (mem_n_read != (ssize_t)mem_remote.iov_len) {
-        printf("Error reading process memory: short read of %ld bytes\n", (long)mem_n_read);
-        exit(1);
     }
 
     return buffer;
@@ -107,9 +338,278 @@ bool handle_memory_error(uint32_t err)
     return true;
 }
 
+static uint64_t pointer_cache_hash(uint64_t start, const int64_t* offsets, int depth)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    hash = (hash ^ start) * 0x100000001b3ULL;
+    for (int i = 0; i < depth; i++)
+        hash = (hash ^ (uint64_t)offsets[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+static void pointer_cache_flush()
+{
+    pointer_cache_generation++;
+    pointer_cache_size = 0;
+    validated_root_count = 0;
+}
+
+static uint64_t read_pointer(uint64_t address, int32_t* err)
+{
+    if (!process_address_mapped(address)) {
+        *err = EFAULT;
+        memory_error = true;
+        return 0;
+    }
+    if (address <= UINT32_MAX)
+        return read_memory_uint32_t(address, err);
+    return read_memory_uint64_t(address, err);
+}
+
+/*
+    Entries from an older tick are only trusted if the root pointer of their
+    path still holds the same value, every root is read at most once per tick
+*/
+static bool pointer_cache_validate(pointer_cache_entry* entry)
+{
+    for (int i = 0; i < validated_root_count; i++) {
+        if (validated_roots[i].start == entry->start) {
+            if (validated_roots[i].root != entry->root)
+                return false;
+            entry->tick = memory_tick;
+            return true;
+        }
+    }
+
+    int32_t err = 0;
+    memory_error = false;
+    uint64_t root = read_pointer(entry->start, &err);
+    if (memory_error)
+        return false;
+    if (validated_root_count < POINTER_CACHE_MAX_ROOTS) {
+        validated_roots[validated_root_count].start = entry->start;
+        validated_roots[validated_root_count].root = root;
+        validated_root_count++;
+    }
+    if (root != entry->root)
+        return false;
+    entry->tick = memory_tick;
+    return true;
+}
+
+/*
+    Finds the longest cached prefix of a pointer path
+    Returns the number of hops that are already resolved, 0 on a miss
+*/
+static int pointer_cache_lookup(uint64_t start, const int64_t* offsets, int count, uint64_t* address, uint64_t* root)
+{
+    if (!memory_tick_active || pointer_cache_cycles == 0 || count == 0)
+        return 0;
+
+    for (int depth = count; depth > 0; depth--) {
+        uint32_t i = pointer_cache_hash(start, offsets, depth) & (POINTER_CACHE_SIZE - 1);
+        for (int probe = 0; probe < POINTER_CACHE_SIZE; probe++, i = (i + 1) & (POINTER_CACHE_SIZE - 1)) {
+            pointer_cache_entry* entry = &pointer_cache[i];
+            if (entry->generation != pointer_cache_generation)
+                break;
+            if (entry->depth != depth || entry->start != start || memcmp(entry->offsets, offsets, depth * sizeof(int64_t)) != 0)
+                continue;
+            if (entry->tick != memory_tick && !pointer_cache_validate(entry)) {
+                pointer_cache_flush();
+                memory_statistics.pointer_cache_misses++;
+                return 0;
+            }
+            *address = entry->address;
+            *root = entry->root;
+            memory_statistics.pointer_cache_hits++;
+            return depth;
+        }
+    }
+
+    memory_statistics.pointer_cache_misses++;
+    return 0;
+}
+
+static void pointer_cache_insert(uint64_t start, const int64_t* offsets, int depth, uint64_t address, uint64_t root)
+{
+    if (!memory_tick_active || pointer_cache_cycles == 0 || pointer_cache_size >= POINTER_CACHE_SIZE / 4 * 3)
+        return;
+
+    uint32_t i = pointer_cache_hash(start, offsets, depth) & (POINTER_CACHE_SIZE - 1);
+    pointer_cache_entry* entry = &pointer_cache[i];
+    while (entry->generation == pointer_cache_generation) {
+        if (entry->depth == depth && entry->start == start && memcmp(entry->offsets, offsets, depth * sizeof(int64_t)) == 0)
+            break;
+        i = (i + 1) & (POINTER_CACHE_SIZE - 1);
+        entry = &pointer_cache[i];
+    }
+    if (entry->generation != pointer_cache_generation)
+        pointer_cache_size++;
+
+    entry->generation = pointer_cache_generation;
+    entry->tick = memory_tick;
+    entry->depth = depth;
+    entry->start = start;
+    entry->root = root;
+    entry->address = address;
+    memcpy(entry->offsets, offsets, depth * sizeof(int64_t));
+}
+
+/*
+    Follows a pointer path starting at `start`
+    Every offset is one pointer hop, shared prefixes come from the cache
+*/
+static uint64_t resolve_pointer_path(uint64_t start, const int64_t* offsets, int count, int32_t* err)
+{
+    uint64_t address = start;
+    uint64_t root = 0;
+    int depth = pointer_cache_lookup(start, offsets, count, &address, &root);
+    bool cached = depth > 0;
+
+    for (; depth < count; depth++) {
+        uint64_t pointer = read_pointer(address, err);
+        if (*err) {
+            if (cached) {
+                // The cached prefix went stale, walk the whole path again
+                pointer_cache_flush();
+                memory_error = false;
+                *err = 0;
+                return resolve_pointer_path(start, offsets, count, err);
+            }
+            return address;
+        }
+        if (depth == 0)
+            root = pointer;
+        address = pointer + offsets[depth];
+        pointer_cache_insert(start, offsets, depth + 1, address, root);
+    }
+
+    return address;
+}
+
+/*
+    Finds the memo entry of a readAddress call
+    The entry holds the result if its generation is the current one, else
+    it's a free slot for it. NULL if the call can't be memoized
+*/
+static read_memo_entry* read_memo_find(enum memory_type type, int string_size, uint64_t start, const int64_t* offsets, int count)
+{
+    if (!memory_tick_active || type == MEMORY_TYPE_INVALID)
+        return NULL;
+    if (read_memo == NULL) {
+        read_memo = calloc(READ_MEMO_SIZE, sizeof(read_memo_entry));
+        if (read_memo == NULL)
+            return NULL;
+    }
+
+    uint64_t hash = (pointer_cache_hash(start, offsets, count) ^ (uint64_t)(type * 64 + string_size)) * 0x100000001b3ULL;
+    uint32_t i = (uint32_t)(hash ^ (hash >> 32)) & (READ_MEMO_SIZE - 1);
+    for (int probe = 0; probe < READ_MEMO_SIZE; probe++, i = (i + 1) & (READ_MEMO_SIZE - 1)) {
+        read_memo_entry* entry = &read_memo[i];
+        if (entry->generation != read_memo_generation)
+            return read_memo_size < READ_MEMO_SIZE / 4 * 3 ? entry : NULL;
+        if (entry->type == type && entry->string_size == string_size && entry->start == start && entry->offset_count == count
+            && memcmp(entry->offsets, offsets, count * sizeof(int64_t)) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+// Remembers the value readAddress left on top of the stack
+static void read_memo_store(read_memo_entry* entry, lua_State* L, enum memory_type type, int string_size, uint64_t start, const int64_t* offsets, int count)
+{
+    if (entry == NULL)
+        return;
+
+    // The slot may still hold the string of an older tick
+    free(entry->string);
+    entry->string = NULL;
+    entry->result_type = lua_type(L, -1);
+    if (entry->result_type == LUA_TSTRING) {
+        entry->string = strdup(lua_tostring(L, -1));
+        if (entry->string == NULL)
+            return;
+    } else if (entry->result_type == LUA_TBOOLEAN) {
+        entry->number = lua_toboolean(L, -1);
+    } else {
+        entry->number = lua_tonumber(L, -1);
+    }
+
+    entry->generation = read_memo_generation;
+    entry->type = type;
+    entry->string_size = string_size;
+    entry->start = start;
+    entry->offset_count = count;
+    memcpy(entry->offsets, offsets, count * sizeof(int64_t));
+    entry->error = memory_error;
+    read_memo_size++;
+}
+
+static void read_memo_push(lua_State* L, const read_memo_entry* entry)
+{
+    if (entry->result_type == LUA_TSTRING)
+        lua_pushstring(L, entry->string);
+    else if (entry->result_type == LUA_TBOOLEAN)
+        lua_pushboolean(L, entry->number != 0);
+    else
+        lua_pushnumber(L, entry->number);
+}
+
+static void read_memo_flush()
+{
+    read_memo_generation++;
+    read_memo_size = 0;
+}
+
+// Starts an auto splitter tick, readAddress results are memoized until its end
+void memory_tick_start()
+{
+    memory_tick_active = true;
+}
+
+/*
+    Ends the current auto splitter tick
+    Drops the page snapshot and the readAddress memo, and clears the pointer
+    cache once it has been used for `pointerCacheCycles` ticks
+*/
+void memory_tick_end()
+{
+    memory_tick++;
+    validated_root_count = 0;
+    page_snapshot_count = 0;
+    memory_tick_active = false;
+    read_memo_flush();
+
+    if (pointer_cache_cycles != 0) {
+        pointer_cache_cycles_value--;
+        if (pointer_cache_cycles_value < 1) {
+            pointer_cache_flush();
+            pointer_cache_cycles_value = pointer_cache_cycles;
+        }
+    }
+}
+
+// Forgets everything that was read from the game, used when it exits
+void memory_flush()
+{
+    page_snapshot_count = 0;
+    pointer_cache_flush();
+    read_memo_flush();
+}
+
+// Forgets all cached state and statistics, used when a script (re)starts
+void memory_reset()
+{
+    memory_flush();
+    pointer_cache_cycles_value = pointer_cache_cycles;
+    memset(&memory_statistics, 0, sizeof(memory_statistics));
+}
+
 int read_address(lua_State* L)
 {
     memory_error = false;
+    memory_statistics.reads++;
     uint64_t address;
     const char* value_type = lua_tostring(L, 1);
     int i;
@@ -128,19 +628,26 @@ int read_address(lua_State* L)
 
     int error = 0;
 
-    for (; i <= lua_gettop(L); i++) {
-        if (address <= UINT32_MAX) {
-            address = read_memory_uint32_t((uint64_t)address, &error);
-            if (memory_error)
-                break;
-        } else {
-            address = read_memory_uint64_t(address, &error);
-            if (memory_error)
-                break;
-        }
-        address += lua_tointeger(L, i);
+    int64_t offsets[MEMORY_MAX_OFFSETS];
+    int offset_count = 0;
+    if (lua_gettop(L) - i + 1 > MEMORY_MAX_OFFSETS)
+        return luaL_error(L, "readAddress: too many offsets, at most %d", MEMORY_MAX_OFFSETS);
+    for (; i <= lua_gettop(L); i++)
+        offsets[offset_count++] = lua_tointeger(L, i);
+
+    int string_size = 0;
+    enum memory_type type = memory_type_from_string(value_type, &string_size);
+    uint64_t start = address;
+    read_memo_entry* memo = read_memo_find(type, string_size, start, offsets, offset_count);
+    if (memo != NULL && memo->generation == read_memo_generation) {
+        memory_statistics.read_memo_hits++;
+        memory_error = memo->error;
+        read_memo_push(L, memo);
+        return 1;
     }
 
+    address = resolve_pointer_path(address, offsets, offset_count, &error);
+
     if (strcmp(value_type, "sbyte") == 0) {
         int8_t value = read_memory_int8_t(address, &error);
         lua_pushinteger(L, (int)value);
@@ -158,13 +665,13 @@ int read_address(lua_State* L)
         lua_pushinteger(L, value);
     } else if (strcmp(value_type, "uint") == 0) {
         unsigned int value = read_memory_uint32_t(address, &error);
-        lua_pushinteger(L, (int)value);
+        lua_pushnumber(L, (lua_Number)value);
     } else if (strcmp(value_type, "long") == 0) {
         long value = read_memory_int64_t(address, &error);
-        lua_pushinteger(L, (int)value);
+        lua_pushnumber(L, (lua_Number)value);
     } else if (strcmp(value_type, "ulong") == 0) {
         unsigned long value = read_memory_uint64_t(address, &error);
-        lua_pushinteger(L, (int)value);
+        lua_pushnumber(L, (lua_Number)value);
     } else if (strcmp(value_type, "float") == 0) {
         float value = read_memory_float(address, &error);
         lua_pushnumber(L, (double)value);
@@ -183,6 +690,7 @@ int read_address(lua_State* L)
         char* value = read_memory_string(address, buffer_size);
         lua_pushstring(L, value != NULL ? value : "");
         free(value);
+        read_memo_store(memo, L, type, string_size, start, offsets, offset_count);
         return 1;
     } else {
         printf("Invalid value type: %s\n", value_type);
@@ -194,5 +702,533 @@ int read_address(lua_State* L)
         handle_memory_error(error);
     }
 
+    read_memo_store(memo, L, type, string_size, start, offsets, offset_count);
     return 1;
 }
+
+/*
+    Parses a `readAddress` style type name
+    `string_size` is only written for `stringX` types
+*/
+enum memory_type memory_type_from_string(const char* value_type, int* string_size)
+{
+    if (value_type == NULL)
+        return MEMORY_TYPE_INVALID;
+
+    for (int i = 0; i < MEMORY_TYPE_STRING; i++) {
+        if (strcmp(value_type, memory_type_names[i]) == 0)
+            return (enum memory_type)i;
+    }
+
+    if (strncmp(value_type, "string", 6) == 0) {
+        int size = atoi(value_type + 6);
+        if (size < 2)
+            return MEMORY_TYPE_INVALID;
+        *string_size = size;
+        return MEMORY_TYPE_STRING;
+    }
+
+    return MEMORY_TYPE_INVALID;
+}
+
+/*
+    Reads every local/remote iovec pair with the selected memory backend
+    When the page snapshot is enabled, the pages of all the iovecs are loaded
+    in one go and the iovecs are served from them
+*/
+static void read_memory_iovecs(struct iovec* local, struct iovec* remote, int32_t* errors, int count)
+{
+    if (!page_snapshot_enabled || !memory_tick_active || count == 0) {
+        backend_read(local, remote, errors, count);
+        return;
+    }
+
+    uint64_t pages[PAGE_SNAPSHOT_MAX_PAGES] = { 0 };
+    int page_count = 0;
+    for (int i = 0; i < count && page_count < PAGE_SNAPSHOT_MAX_PAGES; i++) {
+        uint64_t address = (uintptr_t)remote[i].iov_base;
+        uint64_t page = address & ~(uint64_t)(PAGE_SNAPSHOT_SIZE - 1);
+        if (remote[i].iov_len == 0 || address + remote[i].iov_len > page + PAGE_SNAPSHOT_SIZE)
+            continue;
+        bool seen = false;
+        for (int j = 0; j < page_count && !seen; j++)
+            seen = pages[j] == page;
+        if (!seen)
+            pages[page_count++] = page;
+    }
+    load_page_snapshots(pages, page_count);
+
+    bool previous_error = memory_error;
+    for (int i = 0; i < count; i++) {
+        errors[i] = 0;
+        if (!read_page_snapshot((uintptr_t)remote[i].iov_base, local[i].iov_base, remote[i].iov_len, &errors[i]))
+            backend_read(&local[i], &remote[i], &errors[i], 1);
+    }
+    memory_error = previous_error;
+}
+
+/*
+    Resolves all pointer paths level by level
+    Every pointer depth is a single scatter-gather read across all paths that
+    still have hops left, the final values are fetched with one more read
+    Strings are allocated here and have to be freed by the caller
+*/
+void read_memory_batch(memory_read* reads, int count)
+{
+    if (count <= 0)
+        return;
+    memory_statistics.reads += count;
+
+    struct iovec* local = malloc(count * sizeof(struct iovec));
+    struct iovec* remote = malloc(count * sizeof(struct iovec));
+    int32_t* errors = malloc(count * sizeof(int32_t));
+    uint64_t* pointers = malloc(count * sizeof(uint64_t));
+    int* index = malloc(count * sizeof(int));
+    int* depths = malloc(count * sizeof(int));
+    uint64_t* starts = malloc(count * sizeof(uint64_t));
+    uint64_t* roots = malloc(count * sizeof(uint64_t));
+    bool* cached = malloc(count * sizeof(bool));
+    if (!local || !remote || !errors || !pointers || !index || !depths || !starts || !roots || !cached) {
+        for (int i = 0; i < count; i++)
+            reads[i].error = ENOMEM;
+        goto batch_done;
+    }
+
+    for (int i = 0; i < count; i++) {
+        memory_read* read = &reads[i];
+        read->error = 0;
+        read->string = NULL;
+        starts[i] = read->address;
+        roots[i] = 0;
+        depths[i] = pointer_cache_lookup(read->address, read->offsets, read->offset_count, &read->address, &roots[i]);
+        cached[i] = depths[i] > 0;
+    }
+
+    for (;;) {
+        int n = 0;
+        for (int i = 0; i < count; i++) {
+            memory_read* read = &reads[i];
+            if (read->error || depths[i] >= read->offset_count)
+                continue;
+            // A fault in the middle of a scatter-gather read splits it, drop bad pointers beforehand
+            if (!process_address_mapped(read->address)) {
+                read->error = EFAULT;
+                if (cached[i])
+                    pointer_cache_flush();
+                continue;
+            }
+            pointers[n] = 0;
+            local[n].iov_base = &pointers[n];
+            local[n].iov_len = read->address <= UINT32_MAX ? sizeof(uint32_t) : sizeof(uint64_t);
+            remote[n].iov_base = (void*)(uintptr_t)read->address;
+            remote[n].iov_len = local[n].iov_len;
+            index[n++] = i;
+        }
+        if (n == 0)
+            break;
+
+        read_memory_iovecs(local, remote, errors, n);
+        for (int j = 0; j < n; j++) {
+            int i = index[j];
+            memory_read* read = &reads[i];
+            if (errors[j]) {
+                read->error = errors[j];
+                if (cached[i]) {
+                    // Stale prefix, make the next tick walk the path again
+                    pointer_cache_flush();
+                    cached[i] = false;
+                }
+                continue;
+            }
+            if (depths[i] == 0)
+                roots[i] = pointers[j];
+            read->address = pointers[j] + read->offsets[depths[i]];
+            depths[i]++;
+            pointer_cache_insert(starts[i], read->offsets, depths[i], read->address, roots[i]);
+        }
+    }
+
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        memory_read* read = &reads[i];
+        if (read->error)
+            continue;
+        if (read->type == MEMORY_TYPE_STRING) {
+            read->string = calloc(read->string_size, 1);
+            if (read->string == NULL) {
+                read->error = ENOMEM;
+                continue;
+            }
+            local[n].iov_base = read->string;
+            local[n].iov_len = read->string_size - 1;
+        } else {
+            read->value.u64 = 0;
+            local[n].iov_base = &read->value;
+            local[n].iov_len = memory_type_sizes[read->type];
+        }
+        remote[n].iov_base = (void*)(uintptr_t)read->address;
+        remote[n].iov_len = local[n].iov_len;
+        index[n++] = i;
+    }
+
+    read_memory_iovecs(local, remote, errors, n);
+    for (int j = 0; j < n; j++) {
+        memory_read* read = &reads[index[j]];
+        read->error = errors[j];
+        if (read->error && read->string)
+            read->string[0] = '\0';
+    }
+
+batch_done:
+    free(local);
+    free(remote);
+    free(errors);
+    free(pointers);
+    free(index);
+    free(depths);
+    free(starts);
+    free(roots);
+    free(cached);
+}
+
+static uint64_t module_base_address(const char* module)
+{
+    if (strcmp(process.name, module) == 0)
+        return process.base_address;
+    return find_base_address(module);
+}
+
+/*
+    Fills `read` from the Lua values in [first, last], laid out the same way
+    as the arguments of `readAddress`
+*/
+bool parse_memory_read(lua_State* L, int first, int last, memory_read* read)
+{
+    memset(read, 0, sizeof(*read));
+    read->type = memory_type_from_string(lua_tostring(L, first), &read->string_size);
+    if (read->type == MEMORY_TYPE_INVALID)
+        return false;
+
+    int i;
+    if (lua_isnumber(L, first + 1)) {
+        read->address = process.base_address + lua_tointeger(L, first + 1);
+        i = first + 2;
+    } else if (lua_isstring(L, first + 1)) {
+        read->address = module_base_address(lua_tostring(L, first + 1)) + lua_tointeger(L, first + 2);
+        i = first + 3;
+    } else {
+        return false;
+    }
+
+    if (last - i + 1 > MEMORY_MAX_OFFSETS)
+        return false;
+    for (; i <= last; i++)
+        read->offsets[read->offset_count++] = lua_tointeger(L, i);
+
+    return true;
+}
+
+void push_memory_read(lua_State* L, const memory_read* read)
+{
+    if (read->type == MEMORY_TYPE_STRING) {
+        lua_pushstring(L, read->string != NULL ? read->string : "");
+        return;
+    }
+    if (read->error) {
+        handle_memory_error(read->error);
+        lua_pushinteger(L, -1);
+        return;
+    }
+
+    switch (read->type) {
+        case MEMORY_TYPE_SBYTE:
+            lua_pushinteger(L, read->value.i8);
+            break;
+        case MEMORY_TYPE_BYTE:
+            lua_pushinteger(L, read->value.u8);
+            break;
+        case MEMORY_TYPE_SHORT:
+            lua_pushinteger(L, read->value.i16);
+            break;
+        case MEMORY_TYPE_USHORT:
+            lua_pushinteger(L, read->value.u16);
+            break;
+        case MEMORY_TYPE_INT:
+            lua_pushinteger(L, read->value.i32);
+            break;
+        case MEMORY_TYPE_UINT:
+            lua_pushnumber(L, (lua_Number)read->value.u32);
+            break;
+        case MEMORY_TYPE_LONG:
+            lua_pushnumber(L, (lua_Number)read->value.i64);
+            break;
+        case MEMORY_TYPE_ULONG:
+            lua_pushnumber(L, (lua_Number)read->value.u64);
+            break;
+        case MEMORY_TYPE_FLOAT:
+            lua_pushnumber(L, (lua_Number)read->value.f32);
+            break;
+        case MEMORY_TYPE_DOUBLE:
+            lua_pushnumber(L, read->value.f64);
+            break;
+        case MEMORY_TYPE_BOOL:
+            lua_pushboolean(L, read->value.b ? 1 : 0);
+            break;
+        default:
+            lua_pushnil(L);
+            break;
+    }
+}
+
+/*
+    Batched version of `readAddress`
+    Takes a table of `readAddress` argument lists and returns a table with
+    the values stored under the same keys
+*/
+int read_addresses(lua_State* L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_settop(L, 1);
+
+    int count = 0;
+    lua_pushnil(L);
+    while (lua_next(L, 1) != 0) {
+        count++;
+        lua_pop(L, 1);
+    }
+
+    memory_read* reads = calloc(count > 0 ? count : 1, sizeof(memory_read));
+    if (reads == NULL)
+        return luaL_error(L, "readAddresses: out of memory");
+
+    int i = 0;
+    lua_pushnil(L);
+    while (lua_next(L, 1) != 0) {
+        int top = lua_gettop(L);
+        int length = lua_istable(L, top) ? (int)lua_objlen(L, top) : 0;
+        if (length < 2 || !lua_checkstack(L, length)) {
+            free(reads);
+            return luaL_error(L, "readAddresses: entry %d is not a valid address", i + 1);
+        }
+        for (int j = 1; j <= length; j++)
+            lua_rawgeti(L, top, j);
+        if (!parse_memory_read(L, top + 1, top + length, &reads[i])) {
+            free(reads);
+            return luaL_error(L, "readAddresses: entry %d is not a valid address", i + 1);
+        }
+        lua_settop(L, top - 1);
+        i++;
+    }
+
+    read_memory_batch(reads, count);
+
+    lua_createtable(L, 0, count);
+    i = 0;
+    lua_pushnil(L);
+    while (lua_next(L, 1) != 0) {
+        lua_pop(L, 1);
+        lua_pushvalue(L, -1);
+        push_memory_read(L, &reads[i]);
+        lua_settable(L, 2);
+        free(reads[i].string);
+        i++;
+    }
+
+    free(reads);
+    return 1;
+}
+
+/*
+    FFI memory API
+    The `mem` table is built by a Lua prelude on top of these two C
+    functions, so reads are plain FFI calls that LuaJIT can compile into
+    the script's traces. The ffi module itself isn't exposed to scripts
+*/
+typedef struct memory_ffi_api {
+    uint64_t (*module_base)(const char* module);
+    int (*read)(uint64_t address, const int64_t* offsets, int offset_count, void* buffer, size_t size);
+} memory_ffi_api;
+
+static uint64_t ffi_module_base(const char* module)
+{
+    if (module == NULL)
+        return process.base_address;
+    return module_base_address(module);
+}
+
+// Follows a pointer path and copies `size` bytes from where it ends into `buffer`
+static int ffi_read(uint64_t address, const int64_t* offsets, int offset_count, void* buffer, size_t size)
+{
+    int32_t error = 0;
+    memory_error = false;
+    memory_statistics.reads++;
+    address = resolve_pointer_path(address, offsets, offset_count, &error);
+    if (error)
+        return error;
+
+    struct iovec local = { .iov_base = buffer, .iov_len = size };
+    struct iovec remote = { .iov_base = (void*)(uintptr_t)address, .iov_len = size };
+    read_memory_iovecs(&local, &remote, &error, 1);
+    return error;
+}
+
+static const memory_ffi_api ffi_api = {
+    .module_base = ffi_module_base,
+    .read = ffi_read,
+};
+
+static const char* memory_ffi_prelude = "local ffi, api_pointer, setmetatable = ...\n"
+                                        "ffi.cdef[[\n"
+                                        "typedef struct {\n"
+                                        "    uint64_t (*module_base)(const char* module);\n"
+                                        "    int (*read)(uint64_t address, const int64_t* offsets, int offset_count, void* buffer, size_t size);\n"
+                                        "} libresplit_memory_api;\n"
+                                        "]]\n"
+                                        "local api = ffi.cast('libresplit_memory_api*', api_pointer)\n"
+                                        "local select, type, error, pairs = select, type, error, pairs\n"
+                                        "local offsets = ffi.new('int64_t[32]')\n"
+                                        "local buffer_data = setmetatable({}, { __mode = 'k' })\n"
+                                        "local buffer_sizes = setmetatable({}, { __mode = 'k' })\n"
+                                        "local string_buffer = ffi.new('char[?]', 256)\n"
+                                        "local string_buffer_size = 256\n"
+                                        "local mem = {}\n"
+                                        "\n"
+                                        "-- Fills `offsets`, returns the start of the path and the number of offsets\n"
+                                        "local function path(where, ...)\n"
+                                        "    local first = 1\n"
+                                        "    local start\n"
+                                        "    if type(where) == 'string' then\n"
+                                        "        start = api.module_base(where) + (...)\n"
+                                        "        first = 2\n"
+                                        "    else\n"
+                                        "        start = api.module_base(nil) + where\n"
+                                        "    end\n"
+                                        "    local count = select('#', ...) - first + 1\n"
+                                        "    if count > 32 then error('too many offsets', 3) end\n"
+                                        "    for i = 0, count - 1 do\n"
+                                        "        offsets[i] = (select(first + i, ...))\n"
+                                        "    end\n"
+                                        "    return start, count\n"
+                                        "end\n"
+                                        "\n"
+                                        "local types = {\n"
+                                        "    sbyte = 'int8_t', byte = 'uint8_t', short = 'int16_t', ushort = 'uint16_t',\n"
+                                        "    int = 'int32_t', uint = 'uint32_t', long = 'int64_t', ulong = 'uint64_t',\n"
+                                        "    float = 'float', double = 'double', bool = 'bool',\n"
+                                        "}\n"
+                                        "local values, sizes = {}, {}\n"
+                                        "for name, ctype in pairs(types) do\n"
+                                        "    local value = ffi.new(ctype .. '[1]')\n"
+                                        "    local size = ffi.sizeof(ctype)\n"
+                                        "    values[name], sizes[name] = value, size\n"
+                                        "    mem[name] = function(...)\n"
+                                        "        local start, count = path(...)\n"
+                                        "        if api.read(start, offsets, count, value, size) ~= 0 then return nil end\n"
+                                        "        return value[0]\n"
+                                        "    end\n"
+                                        "end\n"
+                                        "\n"
+                                        "function mem.read(value_type, ...)\n"
+                                        "    local reader = types[value_type] and mem[value_type]\n"
+                                        "    if not reader then error('invalid value type: ' .. tostring(value_type), 2) end\n"
+                                        "    return reader(...)\n"
+                                        "end\n"
+                                        "\n"
+                                        "function mem.string(size, ...)\n"
+                                        "    if size < 2 then error('invalid string size', 2) end\n"
+                                        "    if size > string_buffer_size then\n"
+                                        "        string_buffer = ffi.new('char[?]', size)\n"
+                                        "        string_buffer_size = size\n"
+                                        "    end\n"
+                                        "    string_buffer[size - 1] = 0\n"
+                                        "    local start, count = path(...)\n"
+                                        "    if api.read(start, offsets, count, string_buffer, size - 1) ~= 0 then return nil end\n"
+                                        "    return ffi.string(string_buffer)\n"
+                                        "end\n"
+                                        "\n"
+                                        "-- Buffers are empty proxies, their bytes stay out of the scripts' reach\n"
+                                        "local function is_index(n)\n"
+                                        "    return type(n) == 'number' and n >= 0 and n % 1 == 0\n"
+                                        "end\n"
+                                        "\n"
+                                        "local function buffer_bytes(buffer, offset, length, level)\n"
+                                        "    local size = buffer_sizes[buffer]\n"
+                                        "    if not size then error('expected a buffer from mem.buffer', level) end\n"
+                                        "    if not is_index(offset) or not is_index(length) or offset + length > size then\n"
+                                        "        error('buffer range out of bounds: ' .. tostring(offset) .. ', ' .. tostring(length), level)\n"
+                                        "    end\n"
+                                        "    return buffer_data[buffer] + offset\n"
+                                        "end\n"
+                                        "\n"
+                                        "local buffer_methods = {}\n"
+                                        "\n"
+                                        "function buffer_methods.size(buffer)\n"
+                                        "    return buffer_sizes[buffer]\n"
+                                        "end\n"
+                                        "\n"
+                                        "function buffer_methods.read(buffer, value_type, offset)\n"
+                                        "    local size = sizes[value_type]\n"
+                                        "    if not size then error('invalid value type: ' .. tostring(value_type), 2) end\n"
+                                        "    local value = values[value_type]\n"
+                                        "    ffi.copy(value, buffer_bytes(buffer, offset, size, 3), size)\n"
+                                        "    return value[0]\n"
+                                        "end\n"
+                                        "\n"
+                                        "function buffer_methods.string(buffer, offset, length)\n"
+                                        "    return ffi.string(buffer_bytes(buffer, offset, length, 3), length)\n"
+                                        "end\n"
+                                        "\n"
+                                        "local buffer_meta = {\n"
+                                        "    __metatable = false,\n"
+                                        "    __index = function(buffer, key)\n"
+                                        "        if type(key) == 'number' then return buffer_bytes(buffer, key, 1, 2)[0] end\n"
+                                        "        return buffer_methods[key]\n"
+                                        "    end,\n"
+                                        "    __newindex = function()\n"
+                                        "        error('buffers are read-only', 2)\n"
+                                        "    end,\n"
+                                        "}\n"
+                                        "\n"
+                                        "function mem.buffer(size)\n"
+                                        "    if not is_index(size) or size == 0 then error('invalid buffer size', 2) end\n"
+                                        "    local buffer = setmetatable({}, buffer_meta)\n"
+                                        "    buffer_data[buffer] = ffi.new('uint8_t[?]', size)\n"
+                                        "    buffer_sizes[buffer] = size\n"
+                                        "    return buffer\n"
+                                        "end\n"
+                                        "\n"
+                                        "function mem.readInto(buffer, ...)\n"
+                                        "    local size = buffer_sizes[buffer]\n"
+                                        "    if not size then error('mem.readInto expects a buffer from mem.buffer', 2) end\n"
+                                        "    local start, count = path(...)\n"
+                                        "    return api.read(start, offsets, count, buffer_data[buffer], size) == 0\n"
+                                        "end\n"
+                                        "\n"
+                                        "function mem.base(module)\n"
+                                        "    return api.module_base(module)\n"
+                                        "end\n"
+                                        "\n"
+                                        "return mem\n";
+
+/*
+    Opens the ffi module privately and publishes the `mem` table
+    Has to run before setmetatable is removed from the globals
+*/
+void open_memory_ffi(lua_State* L)
+{
+    if (luaL_loadstring(L, memory_ffi_prelude) != LUA_OK) {
+        printf("Couldn't load the memory FFI prelude: %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1); // Remove the error message from the stack
+        return;
+    }
+    lua_pushcfunction(L, luaopen_ffi);
+    lua_call(L, 0, 1); // Leaves the ffi module on the stack without making it a global
+    lua_pushlightuserdata(L, (void*)&ffi_api);
+    lua_getglobal(L, "setmetatable");
+    if (lua_pcall(L, 3, 1, 0) != LUA_OK) {
+        printf("Couldn't load the memory FFI prelude: %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1); // Remove the error message from the stack
+        return;
+    }
+    lua_setglobal(L, "mem");
+}
@@ -2,11 +2,81 @@
 #define __MEMORY_H__
 
 #include <luajit.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/uio.h>
 
-ssize_t process_vm_readv(int pid, struct iovec* mem_local, int liovcnt, struct iovec* mem_remote, int riovcnt, int flags);
+#define MEMORY_MAX_OFFSETS 32
+
+enum memory_type {
+    MEMORY_TYPE_SBYTE,
+    MEMORY_TYPE_BYTE,
+    MEMORY_TYPE_SHORT,
+    MEMORY_TYPE_USHORT,
+    MEMORY_TYPE_INT,
+    MEMORY_TYPE_UINT,
+    MEMORY_TYPE_LONG,
+    MEMORY_TYPE_ULONG,
+    MEMORY_TYPE_FLOAT,
+    MEMORY_TYPE_DOUBLE,
+    MEMORY_TYPE_BOOL,
+    MEMORY_TYPE_STRING,
+    MEMORY_TYPE_INVALID,
+};
+
+/*
+    A single value to read through a pointer path
+    `address` starts as module base + first offset, every entry of `offsets`
+    is one pointer hop, the value is then read from the resulting `address`
+*/
+typedef struct memory_read {
+    enum memory_type type;
+    int string_size;
+    uint64_t address;
+    int64_t offsets[MEMORY_MAX_OFFSETS];
+    int offset_count;
+    int32_t error;
+    union {
+        int8_t i8;
+        uint8_t u8;
+        int16_t i16;
+        uint16_t u16;
+        int32_t i32;
+        uint32_t u32;
+        int64_t i64;
+        uint64_t u64;
+        float f32;
+        double f64;
+        bool b;
+    } value;
+    char* string;
+} memory_read;
+
+typedef struct memory_stats {
+    uint64_t pointer_cache_hits;
+    uint64_t pointer_cache_misses;
+    uint64_t page_snapshot_hits;
+    uint64_t page_snapshot_pages;
+    uint64_t reads; // Values asked for by the script, through readAddress, readAddresses, watchers and mem
+    uint64_t read_memo_hits; // readAddress calls answered from earlier calls of the same tick
+} memory_stats;
+
+extern _Thread_local memory_stats memory_statistics;
+extern _Thread_local int pointer_cache_cycles;
+extern _Thread_local bool page_snapshot_enabled;
+
+enum memory_type memory_type_from_string(const char* value_type, int* string_size);
+void read_memory_batch(memory_read* reads, int count);
+void memory_tick_start();
+void memory_tick_end();
+void memory_flush();
+void memory_reset();
+bool parse_memory_read(lua_State* L, int first, int last, memory_read* read);
+void push_memory_read(lua_State* L, const memory_read* read);
 
 int read_address(lua_State* L);
+int read_addresses(lua_State* L);
+void open_memory_ffi(lua_State* L);
 
 #endif /* __MEMORY_H__ */
@@ -1,115 +1,959 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
 #include <linux/limits.h>
 #include <signal.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include <lauxlib.h>
 #include <luajit.h>
 
 #include "auto-splitter.h"
+#include "memory-backend.h"
+#include "memory.h"
 #include "process.h"
+#include "trace.h"
 
-struct game_process process;
-#define MAPS_CACHE_MAX_SIZE 32
-ProcessMap p_maps_cache[MAPS_CACHE_MAX_SIZE];
-uint32_t p_maps_cache_size = 0;
+#ifndef PROCMAP_QUERY
+// From linux/fs.h, for building against headers older than 6.11
+struct procmap_query {
+    uint64_t size;
+    uint64_t query_flags;
+    uint64_t query_addr;
+    uint64_t vma_start;
+    uint64_t vma_end;
+    uint64_t vma_flags;
+    uint64_t vma_page_size;
+    uint64_t vma_offset;
+    uint64_t inode;
+    uint32_t dev_major;
+    uint32_t dev_minor;
+    uint32_t vma_name_size;
+    uint32_t build_id_size;
+    uint64_t vma_name_addr;
+    uint64_t build_id_addr;
+};
 
-void execute_command(const char* command, char* output)
+enum procmap_query_flags {
+    PROCMAP_QUERY_VMA_READABLE = 0x01,
+    PROCMAP_QUERY_VMA_WRITABLE = 0x02,
+    PROCMAP_QUERY_VMA_EXECUTABLE = 0x04,
+    PROCMAP_QUERY_VMA_SHARED = 0x08,
+    PROCMAP_QUERY_COVERING_OR_NEXT_VMA = 0x10,
+    PROCMAP_QUERY_FILE_BACKED_VMA = 0x20,
+};
+
+#define PROCMAP_QUERY _IOWR('f', 17, struct procmap_query)
+#endif
+
+#define LEARNED_REGIONS_SIZE 16
+#define PROCESS_SCAN_FULL_POLLS 50
+
+/*
+    Everything about the game is kept per thread, each auto splitter
+    instance runs on its own thread and attaches to its own process
+*/
+_Thread_local struct game_process process;
+
+/*
+    pidfd of the game, it becomes readable when the game exits and it can't
+    be confused with another process that got the same PID later on
+    -1 when pidfds aren't supported (Linux < 5.3), kill(pid, 0) is used then
+*/
+static _Thread_local int process_pidfd = -1;
+static _Thread_local bool process_exited = false;
+
+/*
+    Index of /proc/pid/maps
+    Parsed once into regions sorted by address and modules (one per mapped
+    file) that are found through a hash on their basename. It's only rebuilt
+    when a lookup misses or a read faults inside a region we know about
+*/
+static _Thread_local struct {
+    int pid;
+    bool dirty;
+    uint32_t generation; // Bumped by every build
+    process_region* regions;
+    int region_count;
+    process_module* modules;
+    int module_count;
+    int* buckets; // Indices into `modules`, -1 when empty
+    uint32_t bucket_mask;
+} module_index = { 0 };
+
+/*
+    Mappings made after the index was built that the kernel told us about
+    Once it's full the index is rebuilt instead, see process_address_mapped
+*/
+static _Thread_local struct {
+    uint64_t start;
+    uint64_t end;
+} learned_regions[LEARNED_REGIONS_SIZE];
+static _Thread_local int learned_region_count = 0;
+
+_Thread_local process_stats process_statistics;
+
+static uint32_t module_name_hash(const char* name)
 {
-    char buffer[4096];
-    FILE* pipe = popen(command, "r");
-    if (!pipe) {
-        fprintf(stderr, "Error executing command: %s\n", command);
-        exit(1);
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (; *name; name++)
+        hash = (hash ^ (uint8_t)*name) * 16777619u;
+    return hash;
+}
+
+static const char* path_basename(const char* path)
+{
+    const char* slash = strrchr(path, '/');
+    return slash != NULL ? slash + 1 : path;
+}
+
+static void free_module_index()
+{
+    for (int i = 0; i < module_index.module_count; i++)
+        free(module_index.modules[i].path);
+    free(module_index.regions);
+    free(module_index.modules);
+    free(module_index.buckets);
+    module_index.regions = NULL;
+    module_index.modules = NULL;
+    module_index.buckets = NULL;
+    module_index.region_count = 0;
+    module_index.module_count = 0;
+    module_index.bucket_mask = 0;
+}
+
+static char* read_maps_file(int pid)
+{
+    char path[22]; // 22 is the maximum length the path can be (strlen("/proc/4294967296/maps"))
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return NULL;
+
+    size_t size = 0;
+    size_t capacity = 64 * 1024;
+    char* buffer = malloc(capacity);
+    while (buffer != NULL) {
+        size += fread(buffer + size, 1, capacity - size - 1, f);
+        if (size < capacity - 1)
+            break;
+        capacity *= 2;
+        char* new_buffer = realloc(buffer, capacity);
+        if (new_buffer == NULL)
+            free(buffer);
+        buffer = new_buffer;
     }
+    fclose(f);
+    if (buffer != NULL)
+        buffer[size] = '\0';
+    return buffer;
+}
 
-    while (fgets(buffer, 128, pipe) != NULL) {
-        strcat(output, buffer);
+/*
+    PROCMAP_QUERY (Linux 6.11+) asks the kernel about a single mapping, so
+    we don't have to go through the text of /proc/pid/maps. Older kernels
+    answer the ioctl with ENOTTY and we fall back to parsing the text
+*/
+static _Thread_local int procmap_fd = -1;
+static _Thread_local int procmap_pid = 0;
+
+static bool procmap_open()
+{
+    // A replayed process doesn't exist, or worse it's another one
+    if (trace_replaying())
+        return false;
+    if (procmap_pid == process.pid)
+        return procmap_fd != -1;
+
+    if (procmap_fd != -1)
+        close(procmap_fd);
+    procmap_pid = process.pid;
+
+    char path[22];
+    snprintf(path, sizeof(path), "/proc/%d/maps", process.pid);
+    procmap_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (procmap_fd == -1)
+        return false;
+
+    struct procmap_query query = { .size = sizeof(query), .query_flags = PROCMAP_QUERY_COVERING_OR_NEXT_VMA };
+    if (ioctl(procmap_fd, PROCMAP_QUERY, &query) == -1 && errno != ENOENT) {
+        close(procmap_fd);
+        procmap_fd = -1;
+        return false;
     }
+    return true;
+}
+
+static void procmap_close()
+{
+    if (procmap_fd != -1)
+        close(procmap_fd);
+    procmap_fd = -1;
+    procmap_pid = 0;
+}
+
+static void procmap_perms(uint64_t flags, char* perms)
+{
+    perms[0] = flags & PROCMAP_QUERY_VMA_READABLE ? 'r' : '-';
+    perms[1] = flags & PROCMAP_QUERY_VMA_WRITABLE ? 'w' : '-';
+    perms[2] = flags & PROCMAP_QUERY_VMA_EXECUTABLE ? 'x' : '-';
+    perms[3] = flags & PROCMAP_QUERY_VMA_SHARED ? 's' : 'p';
+    perms[4] = '\0';
+}
 
-    pclose(pipe);
+static process_region* add_region(int* capacity)
+{
+    if (module_index.region_count == *capacity) {
+        int new_capacity = *capacity ? *capacity * 2 : 256;
+        process_region* regions = realloc(module_index.regions, new_capacity * sizeof(process_region));
+        if (regions == NULL)
+            return NULL;
+        module_index.regions = regions;
+        *capacity = new_capacity;
+    }
+    return &module_index.regions[module_index.region_count++];
 }
 
 /*
-Gets the base address of a module
-if `module` equals to a nullptr, the main process is used, else it will search for the base addr of the specified module
+    Both readers fill module_index.regions and return a buffer with the names
+    of the mapped files, `module` holds the offset of the name in that buffer
+    until the modules get indexed
 */
-uintptr_t find_base_address(const char* module)
+static char* read_regions_procmap()
 {
-    const char* module_to_grep = module == 0 ? process.name : module;
+    int capacity = 0;
+    size_t names_size = 0;
+    size_t names_capacity = 16 * 1024;
+    char* names = malloc(names_capacity);
+    char name[PATH_MAX];
+    uint64_t address = 0;
+
+    while (names != NULL) {
+        struct procmap_query query = {
+            .size = sizeof(query),
+            .query_flags = PROCMAP_QUERY_COVERING_OR_NEXT_VMA,
+            .query_addr = address,
+            .vma_name_size = sizeof(name),
+            .vma_name_addr = (uintptr_t)name,
+        };
+        if (ioctl(procmap_fd, PROCMAP_QUERY, &query) == -1) {
+            if (errno == ENOENT) // No mappings left
+                return names;
+            free(names);
+            return NULL;
+        }
+        address = query.vma_end;
+
+        process_region* region = add_region(&capacity);
+        if (region == NULL)
+            break;
+        region->start = query.vma_start;
+        region->end = query.vma_end;
+        procmap_perms(query.vma_flags, region->perms);
+        region->module = -1;
+        // Anonymous mappings, [heap], [stack] and friends aren't modules
+        if (query.vma_name_size == 0 || name[0] == '[')
+            continue;
 
-    for (int32_t i = 0; i < p_maps_cache_size; i++) {
-        const char* name = p_maps_cache[i].name;
-        if (strstr(name, module_to_grep) == NULL) {
-            return p_maps_cache[i].start;
+        if (names_size + query.vma_name_size > names_capacity) {
+            names_capacity = (names_size + query.vma_name_size) * 2;
+            char* new_names = realloc(names, names_capacity);
+            if (new_names == NULL)
+                break;
+            names = new_names;
         }
+        region->module = names_size;
+        memcpy(names + names_size, name, query.vma_name_size); // Includes the NUL
+        names_size += query.vma_name_size;
     }
 
-    char path[22]; // 22 is the maximum length the path can be (strlen("/proc/4294967296/maps"))
+    free(names);
+    return NULL;
+}
 
-    snprintf(path, sizeof(path), "/proc/%d/maps", process.pid);
+static char* read_regions_text()
+{
+    char* maps = trace_replaying() ? trace_replay_maps() : read_maps_file(process.pid);
+    if (maps == NULL)
+        return NULL;
 
-    FILE* f = fopen(path, "r");
+    int capacity = 0;
+    for (char* line = strtok(maps, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        unsigned long start, end;
+        char mode[8];
+        int name_start = 0;
+        // Thank you kernel source code
+        if (sscanf(line, "%lx-%lx %7s %*s %*s %*s %n", &start, &end, mode, &name_start) < 3)
+            continue;
 
-    if (f) {
-        char current_line[PATH_MAX + 100];
-        while (fgets(current_line, sizeof(current_line), f) != NULL) {
-            if (strstr(current_line, module_to_grep) == NULL)
-                continue;
-            fclose(f);
-            uintptr_t addr_start = strtoull(current_line, NULL, 16);
-            if (maps_cache_cycles_value != 0 && p_maps_cache_size < MAPS_CACHE_MAX_SIZE) {
-                ProcessMap map;
-                if (parseMapsLine(current_line, &map)) {
-                    p_maps_cache[p_maps_cache_size] = map;
-                    p_maps_cache_size++;
-                }
+        process_region* region = add_region(&capacity);
+        if (region == NULL) {
+            free(maps);
+            return NULL;
+        }
+        region->start = start;
+        region->end = end;
+        snprintf(region->perms, sizeof(region->perms), "%.4s", mode);
+        region->module = -1;
+        // [heap], [stack] and friends aren't modules
+        if (name_start > 0 && line[name_start] != '\0' && line[name_start] != '[')
+            region->module = line + name_start - maps;
+    }
+    return maps;
+}
+
+// Adds a region to the module mapped from `path`, creating the module if needed
+static int index_module(const char* path, const process_region* region)
+{
+    const char* name = path_basename(path);
+    uint32_t i = module_name_hash(name) & module_index.bucket_mask;
+    while (module_index.buckets[i] != -1) {
+        process_module* module = &module_index.modules[module_index.buckets[i]];
+        if (strcmp(module->path, path) == 0) {
+            module->end = region->end;
+            for (int p = 0; p < 3; p++) {
+                if (region->perms[p] != '-')
+                    module->perms[p] = region->perms[p];
             }
-            return addr_start;
+            return module_index.buckets[i];
+        }
+        i = (i + 1) & module_index.bucket_mask;
+    }
+
+    process_module* module = &module_index.modules[module_index.module_count];
+    module->path = strdup(path);
+    if (module->path == NULL)
+        return -1;
+    module->name = path_basename(module->path);
+    module->base = region->start;
+    module->end = region->end;
+    memcpy(module->perms, region->perms, sizeof(module->perms));
+    module_index.buckets[i] = module_index.module_count;
+    return module_index.module_count++;
+}
+
+/*
+    Reads the mappings of the process into the module index
+    Returns false if the mappings couldn't be read
+*/
+static bool build_module_index()
+{
+    free_module_index();
+    learned_region_count = 0;
+    module_index.pid = process.pid;
+    module_index.dirty = false;
+    module_index.generation++;
+    process_statistics.module_index_builds++;
+
+    char* names = procmap_open() ? read_regions_procmap() : NULL;
+    if (names == NULL) {
+        free_module_index();
+        names = read_regions_text();
+    }
+    if (names == NULL) {
+        free_module_index();
+        return false;
+    }
+
+    uint32_t bucket_count = 16;
+    while (bucket_count < (uint32_t)module_index.region_count * 2)
+        bucket_count *= 2;
+    module_index.modules = malloc((module_index.region_count + 1) * sizeof(process_module));
+    module_index.buckets = malloc(bucket_count * sizeof(int));
+    if (!module_index.modules || !module_index.buckets) {
+        free(names);
+        free_module_index();
+        return false;
+    }
+    module_index.bucket_mask = bucket_count - 1;
+    memset(module_index.buckets, -1, bucket_count * sizeof(int));
+
+    for (int i = 0; i < module_index.region_count; i++) {
+        process_region* region = &module_index.regions[i];
+        if (region->module != -1)
+            region->module = index_module(names + region->module, region);
+    }
+
+    free(names);
+
+    if (trace_recording()) {
+        char* maps = read_maps_file(process.pid);
+        if (maps != NULL)
+            trace_record_maps(maps, strlen(maps));
+        free(maps);
+    }
+    return true;
+}
+
+static bool module_index_stale()
+{
+    return module_index.regions == NULL || module_index.dirty || module_index.pid != process.pid;
+}
+
+static const process_module* lookup_module(const char* name)
+{
+    if (module_index.buckets == NULL)
+        return NULL;
+
+    uint32_t i = module_name_hash(name) & module_index.bucket_mask;
+    while (module_index.buckets[i] != -1) {
+        const process_module* module = &module_index.modules[module_index.buckets[i]];
+        if (strcmp(module->name, name) == 0)
+            return module;
+        i = (i + 1) & module_index.bucket_mask;
+    }
+
+    // Not a basename, fall back to the first module whose path contains it
+    for (int m = 0; m < module_index.module_count; m++) {
+        if (strstr(module_index.modules[m].path, name) != NULL)
+            return &module_index.modules[m];
+    }
+    return NULL;
+}
+
+/*
+    Finds a module by its file name
+    The index is rebuilt once if the module isn't in it
+*/
+const process_module* find_module(const char* name)
+{
+    process_statistics.module_lookups++;
+    if (module_index_stale())
+        build_module_index();
+
+    const process_module* module = lookup_module(name);
+    if (module == NULL) {
+        build_module_index();
+        module = lookup_module(name);
+    }
+    return module;
+}
+
+// Finds the region that contains `address`, NULL if it isn't mapped
+const process_region* find_region(uint64_t address)
+{
+    process_statistics.module_lookups++;
+    if (module_index_stale())
+        build_module_index();
+
+    int low = 0;
+    int high = module_index.region_count - 1;
+    while (low <= high) {
+        int middle = low + (high - low) / 2;
+        const process_region* region = &module_index.regions[middle];
+        if (address < region->start)
+            high = middle - 1;
+        else if (address >= region->end)
+            low = middle + 1;
+        else
+            return region;
+    }
+    return NULL;
+}
+
+/*
+    Called when a read fails
+    A fault inside a region we know about means the mappings changed, so the
+    index gets rebuilt on the next lookup, or the learned mapping is forgotten
+*/
+void process_note_fault(uint64_t address)
+{
+    for (int i = 0; i < learned_region_count; i++) {
+        if (address >= learned_regions[i].start && address < learned_regions[i].end) {
+            learned_regions[i] = learned_regions[--learned_region_count];
+            return;
         }
-        fclose(f);
     }
+    if (module_index_stale())
+        return;
+    if (find_region(address) != NULL)
+        module_index.dirty = true;
+}
+
+/*
+    Checks if `address` can be read before following a pointer to it
+    The index has every mapping, anonymous ones included. Addresses outside
+    of it are asked to the kernel when PROCMAP_QUERY is available, without it
+    they're assumed to be fine and the read decides
+*/
+/*
+    Changes every time the module index is rebuilt, which it is first if a
+    read faulted since the last build. Base addresses found with an older
+    generation may be out of date, the module may have been loaded again
+*/
+uint32_t module_index_generation()
+{
+    if (module_index_stale())
+        build_module_index();
+    return module_index.generation;
+}
+
+bool process_address_mapped(uint64_t address)
+{
+    const process_region* region = find_region(address);
+    if (region != NULL)
+        return region->perms[0] == 'r';
+
+    for (int i = 0; i < learned_region_count; i++) {
+        if (address >= learned_regions[i].start && address < learned_regions[i].end)
+            return true;
+    }
+
+    if (!procmap_open())
+        return true;
+
+    struct procmap_query query = {
+        .size = sizeof(query),
+        .query_flags = PROCMAP_QUERY_VMA_READABLE,
+        .query_addr = address,
+    };
+    if (ioctl(procmap_fd, PROCMAP_QUERY, &query) == -1)
+        return errno != ENOENT;
+
+    // The game mapped a lot since the index was built, build it again
+    if (learned_region_count == LEARNED_REGIONS_SIZE) {
+        module_index.dirty = true;
+        return true;
+    }
+    learned_regions[learned_region_count].start = query.vma_start;
+    learned_regions[learned_region_count].end = query.vma_end;
+    learned_region_count++;
+    return true;
+}
+
+// Drops the module index, it's rebuilt on the next lookup
+void invalidate_modules()
+{
+    free_module_index();
+    procmap_close();
+    learned_region_count = 0;
+    module_index.pid = 0;
+}
+
+/*
+Gets the base address of a module
+if `module` equals to a nullptr, the main process is used, else it will search for the base addr of the specified module
+*/
+uintptr_t find_base_address(const char* module)
+{
+    const char* module_to_grep = module == 0 ? process.name : module;
+
+    const process_module* found = find_module(module_to_grep);
+    if (found != NULL)
+        return found->base;
+
     printf("Couldn't find base address\n");
     return 0;
 }
 
-void stock_process_id(const char* pid_command)
+/*
+Collects every mapping of a module, sorted by address like in /proc/pid/maps
+`path` receives the file the module was mapped from
+Returns the number of regions found
+*/
+int find_module_regions(const char* module, module_region* regions, int max_regions, char* path, size_t path_size)
+{
+    const process_module* found = find_module(module);
+    if (found == NULL)
+        return 0;
+
+    int index = found - module_index.modules;
+    if (path != NULL)
+        snprintf(path, path_size, "%s", found->path);
+
+    int count = 0;
+    for (int i = 0; i < module_index.region_count && count < max_regions; i++) {
+        const process_region* region = &module_index.regions[i];
+        if (region->module != index)
+            continue;
+        regions[count].start = region->start;
+        regions[count].end = region->end;
+        regions[count].readable = region->perms[0] == 'r';
+        count++;
+    }
+    return count;
+}
+
+/*
+    Lua: getModules()
+    Returns every module mapped in the game, sorted by base address
+*/
+int get_modules(lua_State* L)
+{
+    if (module_index_stale())
+        build_module_index();
+
+    lua_createtable(L, module_index.module_count, 0);
+    for (int i = 0; i < module_index.module_count; i++) {
+        const process_module* module = &module_index.modules[i];
+        lua_createtable(L, 0, 5);
+        lua_pushstring(L, module->name);
+        lua_setfield(L, -2, "name");
+        lua_pushstring(L, module->path);
+        lua_setfield(L, -2, "path");
+        lua_pushnumber(L, (lua_Number)module->base);
+        lua_setfield(L, -2, "base");
+        lua_pushnumber(L, (lua_Number)(module->end - module->base));
+        lua_setfield(L, -2, "size");
+        lua_pushstring(L, module->perms);
+        lua_setfield(L, -2, "perms");
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
+
+/*
+    Process discovery
+    Every poll lists /proc and only inspects PIDs that weren't there on the
+    previous poll, PIDs that disappeared are forgotten. A process can exec
+    into the game after we checked it, so everything is inspected again
+    every PROCESS_SCAN_FULL_POLLS polls
+*/
+static _Thread_local struct {
+    int* checked; // Sorted
+    int checked_count;
+    int polls;
+} process_scanner = { 0 };
+
+static int compare_pids(const void* a, const void* b)
+{
+    return *(const int*)a - *(const int*)b;
+}
+
+static bool checked_pid(int pid)
+{
+    return process_scanner.checked != NULL && bsearch(&pid, process_scanner.checked, process_scanner.checked_count, sizeof(int), compare_pids) != NULL;
+}
+
+static void reset_process_scanner()
+{
+    free(process_scanner.checked);
+    process_scanner.checked = NULL;
+    process_scanner.checked_count = 0;
+    process_scanner.polls = 0;
+}
+
+static ssize_t read_proc_file(int pid, const char* file, char* buffer, size_t size)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, file);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    ssize_t length = read(fd, buffer, size - 1);
+    close(fd);
+    if (length >= 0)
+        buffer[length] = '\0';
+    return length;
+}
+
+/*
+    Compares the file name of `path` against the name the script asked for
+    Windows paths are split on backslashes and compared case-insensitively
+    when looking for an .exe
+*/
+static bool process_name_matches(const char* path, const char* name)
+{
+    const char* file = path;
+    for (const char* c = path; *c; c++) {
+        if (*c == '/' || *c == '\\')
+            file = c + 1;
+    }
+    size_t length = strlen(name);
+    if (length > 4 && strcasecmp(name + length - 4, ".exe") == 0)
+        return strcasecmp(file, name) == 0;
+    return strcmp(file, name) == 0;
+}
+
+enum process_match {
+    PROCESS_MATCH_NONE,
+    PROCESS_MATCH_PARTIAL, // The name is part of the comm, what pgrep used to find
+    PROCESS_MATCH_EXACT,
+};
+
+static bool process_matches_exactly(int pid, const char* comm, const char* name)
+{
+    size_t comm_length = strlen(comm);
+    size_t name_length = strlen(name);
+    if (comm_length == (name_length < 15 ? name_length : 15) && strncmp(comm, name, comm_length) == 0)
+        return true;
+
+    char buffer[PATH_MAX];
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/exe", pid);
+    ssize_t length = readlink(path, buffer, sizeof(buffer) - 1);
+    if (length > 0) {
+        buffer[length] = '\0';
+        if (process_name_matches(buffer, name))
+            return true;
+    }
+
+    length = read_proc_file(pid, "cmdline", buffer, sizeof(buffer));
+    if (length <= 0)
+        return false;
+    if (process_name_matches(buffer, name))
+        return true;
+    const char* loader = strrchr(buffer, '/') ? strrchr(buffer, '/') + 1 : buffer;
+    size_t argv0_length = strlen(buffer);
+    if (strncmp(loader, "wine", 4) == 0 && (ssize_t)argv0_length + 1 < length)
+        return process_name_matches(buffer + argv0_length + 1, name);
+    return false;
+}
+
+/*
+    Checks the comm (truncated to 15 characters by the kernel), the
+    executable and the command line of a process. Wine games show up as
+    the .exe in argv[0], or in argv[1] when started through a wine loader
+    Scripts written when processes were found with pgrep can pass only a
+    part of the comm, that still matches but loses to any exact match
+*/
+static enum process_match process_matches(int pid, const char* comm, const char* name)
+{
+    if (process_matches_exactly(pid, comm, name))
+        return PROCESS_MATCH_EXACT;
+    return strstr(comm, name) != NULL ? PROCESS_MATCH_PARTIAL : PROCESS_MATCH_NONE;
+}
+
+/*
+    Reads the comm and start time from /proc/pid/stat
+    Zombies are skipped, they can't be attached to anymore
+*/
+static bool read_process_stat(int pid, char* comm, size_t comm_size, unsigned long long* start_time)
+{
+    char buffer[1024];
+    if (read_proc_file(pid, "stat", buffer, sizeof(buffer)) <= 0)
+        return false;
+
+    // The comm is in parentheses and can contain anything, including ')'
+    char* open_paren = strchr(buffer, '(');
+    char* close_paren = strrchr(buffer, ')');
+    if (open_paren == NULL || close_paren == NULL || close_paren < open_paren)
+        return false;
+    snprintf(comm, comm_size, "%.*s", (int)(close_paren - open_paren - 1), open_paren + 1);
+
+    char state;
+    // starttime is field 22, the state is field 3
+    if (sscanf(close_paren + 2, "%c %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %llu", &state, start_time) != 2)
+        return false;
+    return state != 'Z';
+}
+
+/*
+    Lists /proc once and returns the matching process, 0 if there's none
+    With multiple matches the oldest one wins, or the newest if `newest`,
+    exact matches win over partial ones
+    `matches` receives the number of matches of the kind that won
+*/
+static int scan_processes(const char* name, bool newest, int* matches)
+{
+    *matches = 0;
+    DIR* proc = opendir("/proc");
+    if (proc == NULL)
+        return 0;
+
+    if (process_scanner.polls++ % PROCESS_SCAN_FULL_POLLS == 0)
+        process_scanner.checked_count = 0;
+
+    int* pids = NULL;
+    int pid_count = 0;
+    int pid_capacity = 0;
+    int self = getpid();
+    int found = 0;
+    enum process_match found_match = PROCESS_MATCH_NONE;
+    unsigned long long found_start_time = 0;
+
+    struct dirent* entry;
+    while ((entry = readdir(proc)) != NULL) {
+        char* end;
+        long pid = strtol(entry->d_name, &end, 10);
+        if (*end != '\0' || pid <= 0)
+            continue;
+
+        if (pid_count == pid_capacity) {
+            pid_capacity = pid_capacity ? pid_capacity * 2 : 512;
+            int* new_pids = realloc(pids, pid_capacity * sizeof(int));
+            if (new_pids == NULL)
+                break;
+            pids = new_pids;
+        }
+        pids[pid_count++] = pid;
+
+        if (pid == self || checked_pid(pid))
+            continue;
+
+        char comm[64];
+        unsigned long long start_time;
+        if (!read_process_stat(pid, comm, sizeof(comm), &start_time))
+            continue;
+        enum process_match match = process_matches(pid, comm, name);
+        if (match == PROCESS_MATCH_NONE || match < found_match)
+            continue;
+        if (match > found_match) {
+            found = 0;
+            found_match = match;
+            *matches = 0;
+        }
+
+        (*matches)++;
+        bool better = newest ? start_time > found_start_time || (start_time == found_start_time && pid > found)
+                             : start_time < found_start_time || (start_time == found_start_time && pid < found);
+        if (found == 0 || better) {
+            found = pid;
+            found_start_time = start_time;
+        }
+    }
+    closedir(proc);
+
+    // Everything that's running now has been checked, vanished PIDs are dropped
+    if (pids != NULL)
+        qsort(pids, pid_count, sizeof(int), compare_pids);
+    free(process_scanner.checked);
+    process_scanner.checked = pids;
+    process_scanner.checked_count = pid_count;
+    return found;
+}
+
+/*
+    Opens a pidfd for the process we just found
+    The start time is checked again afterwards, in case the PID was reused
+    between the scan and pidfd_open
+*/
+static void attach_process()
+{
+    process_exited = false;
+    if (process_pidfd != -1)
+        close(process_pidfd);
+    process_pidfd = -1;
+    if (process.pid == 0)
+        return;
+
+#ifdef SYS_pidfd_open
+    char comm[64];
+    unsigned long long start_time;
+    unsigned long long attached_start_time;
+    if (!read_process_stat(process.pid, comm, sizeof(comm), &start_time))
+        return;
+    int pidfd = syscall(SYS_pidfd_open, process.pid, 0);
+    if (pidfd == -1)
+        return;
+    if (!read_process_stat(process.pid, comm, sizeof(comm), &attached_start_time) || attached_start_time != start_time) {
+        close(pidfd);
+        process_exited = true;
+        return;
+    }
+    process_pidfd = pidfd;
+#endif
+}
+
+// Drops everything that belongs to the attached process
+void process_detach()
+{
+    if (process_pidfd != -1)
+        close(process_pidfd);
+    process_pidfd = -1;
+    process_exited = false;
+    process.pid = 0;
+    process.base_address = 0;
+    process.dll_address = 0;
+    invalidate_modules();
+    memory_flush();
+    memory_backend_detach();
+}
+
+// pidfd of the game, -1 if there's none
+int process_fd()
+{
+    return process_pidfd;
+}
+
+// Called once the pidfd says the game exited
+void process_mark_exited()
+{
+    process_exited = true;
+    invalidate_modules();
+    memory_flush();
+    memory_backend_detach();
+}
+
+// Takes the process from the trace being replayed instead of looking for it
+static void replay_process()
+{
+    int pid;
+    uint64_t base_address;
+    if (!trace_replay_process(&pid, &base_address)) {
+        printf("The trace has no process\n");
+        return;
+    }
+    process.pid = pid;
+    process.base_address = base_address;
+    process.dll_address = base_address;
+    printf("Process: %s\n", process.name);
+    printf("PID: %u (replayed)\n", process.pid);
+}
+
+void stock_process_id(bool newest)
 {
-    char pid_output[PATH_MAX + 100];
-    pid_output[0] = '\0';
+    int matches = 0;
+    if (trace_replaying()) {
+        replay_process();
+        return;
+    }
+    reset_process_scanner();
 
+    // Other instances print too, the console isn't cleared and waiting is only told once
+    bool waiting = false;
     while (atomic_load(&auto_splitter_enabled)) {
-        execute_command(pid_command, pid_output);
-        process.pid = strtoul(pid_output, NULL, 10);
-        printf("\033[2J\033[1;1H"); // Clear the console
+        process.pid = scan_processes(process.name, newest, &matches);
         if (process.pid) {
-            size_t newlinePos = strcspn(pid_output, "\n");
-            if (newlinePos != strlen(pid_output) - 1 && pid_output[0] != '\0') {
-                printf("Multiple PID's found for process: %s\n", process.name);
+            if (matches > 1) {
+                printf("Auto splitter %d: multiple PID's found for process: %s, using the %s one\n",
+                    auto_splitter_instance_index(), process.name, newest ? "newest" : "oldest");
             }
             break;
         } else {
-            printf("%s isn't running.\n", process.name);
+            if (!waiting)
+                printf("Auto splitter %d: %s isn't running.\n", auto_splitter_instance_index(), process.name);
+            waiting = true;
             usleep(100000); // Sleep for 100ms
         }
     }
+    reset_process_scanner();
+    attach_process();
 
     printf("Process: %s\n", process.name);
     printf("PID: %u\n", process.pid);
     process.base_address = find_base_address(NULL);
     process.dll_address = process.base_address;
+    trace_record_process(process.pid, process.base_address);
 }
 
 int find_process_id(lua_State* L)
 {
-    process.name = lua_tostring(L, 1);
-    char command[256];
-    printf("\033[2J\033[1;1H"); // Clear the console
-    snprintf(command, sizeof(command), "pgrep \"%.*s\"", (int)strnlen(process.name, 15), process.name);
+    static const char* const picks[] = { "oldest", "newest", NULL };
+    // The name has to outlive the lua_State, scripts can be reloaded while attached
+    static _Thread_local char process_name[PATH_MAX];
+    const char* name = luaL_checkstring(L, 1);
+    bool newest = luaL_checkoption(L, 2, "oldest", picks) == 1;
+
+    // Reloaded script asking for the game we're already attached to
+    if (process.pid != 0 && process.name != NULL && strcmp(process.name, name) == 0 && process_exists())
+        return 0;
 
-    stock_process_id(command);
+    snprintf(process_name, sizeof(process_name), "%s", name);
+    process.name = process_name;
+
+    stock_process_id(newest);
 
     return 0;
 }
@@ -122,23 +966,8 @@ int getPid(lua_State* L)
 
 int process_exists()
 {
+    if (process_pidfd != -1 || process_exited)
+        return !process_exited;
     int result = kill(process.pid, 0);
     return result == 0;
 }
-
-bool parseMapsLine(char* line, ProcessMap* map)
-{
-    size_t end;
-    char mode[8];
-    unsigned long offset;
-    unsigned int major_id, minor_id, node_id;
-
-    // Thank you kernel source code
-    int sscanf_res = sscanf(line, "%lx-%lx %7s %lx %u:%u %u %s", &map->start,
-        &end, mode, &offset, &major_id,
-        &minor_id, &node_id, map->name);
-    if (!sscanf_res)
-        return false;
-
-    return true;
-}
@@ -15,16 +15,55 @@ struct game_process {
 };
 typedef struct game_process game_process;
 
-typedef struct ProcessMap {
+/*
+    Module index entries
+    Pointers returned by find_module/find_region stay valid until the next
+    lookup, a lookup may rebuild the index
+*/
+// One line of /proc/pid/maps
+typedef struct process_region {
     uint64_t start;
-    char name[PATH_MAX];
-} ProcessMap;
-extern uint32_t p_maps_cache_size;
+    uint64_t end;
+    char perms[5];
+    int module; // -1 for anonymous mappings
+} process_region;
+
+// Every mapping of a single file
+typedef struct process_module {
+    char* path;
+    const char* name; // Basename of `path`
+    uint64_t base;
+    uint64_t end;
+    char perms[5]; // Union of the permissions of the module's mappings
+} process_module;
+
+typedef struct process_stats {
+    uint64_t module_lookups; // Module and region lookups, including the pointer checks
+    uint64_t module_index_builds; // Times /proc/pid/maps had to be read again
+} process_stats;
+
+extern _Thread_local process_stats process_statistics;
+
+typedef struct module_region {
+    uint64_t start;
+    uint64_t end;
+    bool readable;
+} module_region;
 
 uintptr_t find_base_address(const char* module);
+const process_module* find_module(const char* name);
+const process_region* find_region(uint64_t address);
+int find_module_regions(const char* module, module_region* regions, int max_regions, char* path, size_t path_size);
+bool process_address_mapped(uint64_t address);
+void process_note_fault(uint64_t address);
+void invalidate_modules();
+uint32_t module_index_generation();
+int get_modules(lua_State* L);
 int process_exists();
+int process_fd();
+void process_mark_exited();
+void process_detach();
 int find_process_id(lua_State* L);
 int getPid(lua_State* L);
-bool parseMapsLine(char* line, ProcessMap* map);
 
 #endif /* __PROCESS_H__ */
@@ -0,0 +1,281 @@
+#include <errno.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <lauxlib.h>
+
+#include "memory-backend.h"
+#include "memory.h"
+#include "process.h"
+#include "profiler.h"
+#include "settings.h"
+
+#define NANOSECONDS 1000000000ULL
+
+/*
+    Per instance profiler, enabled with the `auto_splitter_profiler` setting
+    The report can be read while the auto splitter runs by connecting to its
+    unix socket, and it's written to a file when the auto splitter stops
+*/
+_Thread_local bool profiler_enabled = false;
+
+static _Thread_local struct {
+    int instance;
+    char script[PATH_MAX];
+    profile_histogram sections[PROFILE_SECTION_COUNT];
+    profile_counter reads;
+    profile_counter syscalls;
+    profile_counter lua_memory; // Bytes
+    uint64_t ticks;
+    uint64_t last_reads; // Totals at the end of the previous tick
+    uint64_t last_syscalls;
+    uint64_t mark; // End of the last recorded section
+    int listen_fd;
+    char socket_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+} profiler = { .listen_fd = -1 };
+
+static const char* profile_section_names[] = {
+    "state",
+    "update",
+    "start",
+    "split",
+    "isLoading",
+    "reset",
+    "watchers",
+    "tick",
+    "gc",
+};
+
+uint64_t profiler_now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * NANOSECONDS + time.tv_nsec;
+}
+
+static void open_socket()
+{
+    const char* directory = getenv("XDG_RUNTIME_DIR");
+    if (directory == NULL)
+        directory = "/tmp";
+    int length = snprintf(profiler.socket_path, sizeof(profiler.socket_path), "%s/libresplit-profiler-%d.sock", directory, profiler.instance);
+    if (length < 0 || length >= (int)sizeof(profiler.socket_path)) {
+        profiler.socket_path[0] = '\0';
+        return;
+    }
+
+    profiler.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (profiler.listen_fd == -1)
+        return;
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    strcpy(address.sun_path, profiler.socket_path);
+    unlink(profiler.socket_path);
+    if (bind(profiler.listen_fd, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(profiler.listen_fd, 4) == -1) {
+        printf("Couldn't open the profiler socket %s: %s\n", profiler.socket_path, strerror(errno));
+        close(profiler.listen_fd);
+        profiler.listen_fd = -1;
+        profiler.socket_path[0] = '\0';
+        return;
+    }
+    printf("Profiler: %s\n", profiler.socket_path);
+}
+
+void profiler_start(int instance, const char* script)
+{
+    memset(profiler.sections, 0, sizeof(profiler.sections));
+    memset(&profiler.reads, 0, sizeof(profiler.reads));
+    memset(&profiler.syscalls, 0, sizeof(profiler.syscalls));
+    memset(&profiler.lua_memory, 0, sizeof(profiler.lua_memory));
+    profiler.ticks = 0;
+    profiler.last_reads = memory_statistics.reads;
+    profiler.last_syscalls = memory_backend_syscalls;
+    profiler.instance = instance;
+    snprintf(profiler.script, sizeof(profiler.script), "%s", script);
+    profiler_enabled = true;
+    if (profiler.listen_fd == -1)
+        open_socket();
+}
+
+// Records the time from `start` until now, the next mark starts from here
+void profiler_record(enum profile_section section, uint64_t start)
+{
+    uint64_t now = profiler_now();
+    uint64_t duration = now > start ? now - start : 0;
+    profiler.mark = now;
+
+    profile_histogram* histogram = &profiler.sections[section];
+    int bucket = duration > 0 ? 63 - __builtin_clzll(duration) : 0;
+    if (bucket >= PROFILE_BUCKETS)
+        bucket = PROFILE_BUCKETS - 1;
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->total += duration;
+    if (duration > histogram->max)
+        histogram->max = duration;
+}
+
+/*
+    Lua: the tick function calls this after each callback with its section,
+    the callback's time is the time since the previous mark
+*/
+int profiler_mark(lua_State* L)
+{
+    lua_Integer section = lua_tointeger(L, 1);
+    if (section >= 0 && section < PROFILE_SECTION_COUNT)
+        profiler_record(section, profiler.mark);
+    return 0;
+}
+
+static void sample(profile_counter* counter, uint64_t value)
+{
+    counter->last = value;
+    counter->total += value;
+    if (value > counter->max)
+        counter->max = value;
+}
+
+// Upper bound of the bucket that holds the `fraction` quantile (at most the max), in nanoseconds
+static uint64_t histogram_quantile(const profile_histogram* histogram, double fraction)
+{
+    uint64_t target = (uint64_t)(histogram->count * fraction);
+    uint64_t seen = 0;
+    for (int i = 0; i < PROFILE_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen > target) {
+            uint64_t bound = (2ULL << i) - 1;
+            return bound < histogram->max ? bound : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+static void write_counter(FILE* file, const char* name, const profile_counter* counter, double scale)
+{
+    double average = profiler.ticks > 0 ? (double)counter->total / profiler.ticks : 0;
+    fprintf(file, "%-20s last %10.1f  average %10.1f  max %10.1f\n",
+        name, counter->last * scale, average * scale, counter->max * scale);
+}
+
+static void write_report(FILE* file)
+{
+    fprintf(file, "Auto splitter %d: %s\n", profiler.instance, profiler.script);
+    fprintf(file, "Ticks: %llu\n\n", (unsigned long long)profiler.ticks);
+
+    fprintf(file, "%-12s %10s %12s %12s %12s %12s\n", "section", "count", "mean (us)", "p50 (us)", "p99 (us)", "max (us)");
+    for (int i = 0; i < PROFILE_SECTION_COUNT; i++) {
+        const profile_histogram* histogram = &profiler.sections[i];
+        if (histogram->count == 0)
+            continue;
+        fprintf(file, "%-12s %10llu %12.1f %12.1f %12.1f %12.1f\n",
+            profile_section_names[i],
+            (unsigned long long)histogram->count,
+            (double)histogram->total / histogram->count / 1000.0,
+            histogram_quantile(histogram, 0.5) / 1000.0,
+            histogram_quantile(histogram, 0.99) / 1000.0,
+            histogram->max / 1000.0);
+    }
+
+    fprintf(file, "\nPer tick\n");
+    write_counter(file, "reads", &profiler.reads, 1);
+    write_counter(file, "syscalls", &profiler.syscalls, 1);
+    write_counter(file, "Lua memory (KiB)", &profiler.lua_memory, 1 / 1024.0);
+
+    uint64_t lookups = process_statistics.module_lookups;
+    uint64_t builds = process_statistics.module_index_builds;
+    fprintf(file, "\nModule index: %llu lookups, built %llu times, %.2f%% hits\n",
+        (unsigned long long)lookups, (unsigned long long)builds,
+        lookups > 0 && lookups >= builds ? 100.0 * (lookups - builds) / lookups : 0.0);
+    fprintf(file, "Pointer cache: %llu hits, %llu misses\n",
+        (unsigned long long)memory_statistics.pointer_cache_hits,
+        (unsigned long long)memory_statistics.pointer_cache_misses);
+    fprintf(file, "Page snapshot: %llu hits, %llu pages\n",
+        (unsigned long long)memory_statistics.page_snapshot_hits,
+        (unsigned long long)memory_statistics.page_snapshot_pages);
+    fprintf(file, "readAddress memo: %llu hits\n",
+        (unsigned long long)memory_statistics.read_memo_hits);
+
+    fprintf(file, "\nHistograms (samples up to each duration)\n");
+    for (int i = 0; i < PROFILE_SECTION_COUNT; i++) {
+        const profile_histogram* histogram = &profiler.sections[i];
+        if (histogram->count == 0)
+            continue;
+        fprintf(file, "%s:", profile_section_names[i]);
+        for (int bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+            if (histogram->buckets[bucket] > 0)
+                fprintf(file, " %.3fus=%llu", ((2ULL << bucket) - 1) / 1000.0, (unsigned long long)histogram->buckets[bucket]);
+        }
+        fprintf(file, "\n");
+    }
+}
+
+// Sends the report to everyone waiting on the socket
+static void serve_socket()
+{
+    int client;
+    while ((client = accept(profiler.listen_fd, NULL, NULL)) != -1) {
+        char* report = NULL;
+        size_t size = 0;
+        FILE* file = open_memstream(&report, &size);
+        if (file != NULL) {
+            write_report(file);
+            fclose(file);
+            if (send(client, report, size, MSG_DONTWAIT | MSG_NOSIGNAL) == -1) {
+                // The client is gone or too slow, it can ask again
+            }
+            free(report);
+        }
+        close(client);
+    }
+}
+
+// Called after every tick, samples the per tick counters
+void profiler_tick_end(lua_State* L)
+{
+    // memory_reset clears the statistics when the script is reloaded
+    if (memory_statistics.reads < profiler.last_reads)
+        profiler.last_reads = 0;
+    sample(&profiler.reads, memory_statistics.reads - profiler.last_reads);
+    profiler.last_reads = memory_statistics.reads;
+    sample(&profiler.syscalls, memory_backend_syscalls - profiler.last_syscalls);
+    profiler.last_syscalls = memory_backend_syscalls;
+    sample(&profiler.lua_memory, (uint64_t)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0));
+    profiler.ticks++;
+
+    if (profiler.listen_fd != -1)
+        serve_socket();
+}
+
+// Writes the report next to the settings and closes the socket
+void profiler_stop()
+{
+    if (!profiler_enabled)
+        return;
+    profiler_enabled = false;
+
+    if (profiler.listen_fd != -1) {
+        serve_socket();
+        close(profiler.listen_fd);
+        unlink(profiler.socket_path);
+        profiler.listen_fd = -1;
+    }
+
+    char path[PATH_MAX];
+    get_libresplit_folder_path(path);
+    char file_name[64];
+    snprintf(file_name, sizeof(file_name), "/auto-splitter-profile-%d.txt", profiler.instance);
+    strcat(path, file_name);
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        printf("Couldn't write the profile to %s: %s\n", path, strerror(errno));
+        return;
+    }
+    write_report(file);
+    fclose(file);
+    printf("Profile written to %s\n", path);
+}
@@ -0,0 +1,49 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <luajit.h>
+
+#define PROFILE_BUCKETS 32
+
+// The first six match the order of the tick callbacks
+enum profile_section {
+    PROFILE_STATE,
+    PROFILE_UPDATE,
+    PROFILE_START,
+    PROFILE_SPLIT,
+    PROFILE_IS_LOADING,
+    PROFILE_RESET,
+    PROFILE_WATCHERS,
+    PROFILE_TICK, // The whole tick, watchers and callbacks included
+    PROFILE_GC, // Garbage collection steps between two ticks
+    PROFILE_SECTION_COUNT,
+};
+
+// Bucket i counts the samples between 2^i and 2^(i+1) - 1 nanoseconds
+typedef struct profile_histogram {
+    uint64_t buckets[PROFILE_BUCKETS];
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+} profile_histogram;
+
+// A value sampled once per tick
+typedef struct profile_counter {
+    uint64_t last;
+    uint64_t max;
+    uint64_t total;
+} profile_counter;
+
+extern _Thread_local bool profiler_enabled;
+
+uint64_t profiler_now();
+void profiler_start(int instance, const char* script);
+void profiler_record(enum profile_section section, uint64_t start);
+void profiler_tick_end(lua_State* L);
+void profiler_stop();
+int profiler_mark(lua_State* L);
+
+#endif /* __PROFILER_H__ */
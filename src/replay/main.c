@@ -0,0 +1,67 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../auto-splitter.h"
+
+/*
+    libresplit-replay: runs an auto splitter script against a trace recorded
+    with the `auto_splitter_record` setting and prints the events it sends
+*/
+
+static const char* event_names[] = {
+    "start",
+    "split",
+    "loading",
+    "reset",
+};
+
+static bool first_event_time_set = false;
+static long long first_event_time;
+static int event_count = 0;
+
+static void print_event(const auto_splitter_event* event)
+{
+    if (!first_event_time_set) {
+        first_event_time = event->time;
+        first_event_time_set = true;
+    }
+    double seconds = (event->time - first_event_time) / 1000000.0;
+    if (event->type == AUTO_SPLITTER_EVENT_LOADING)
+        printf("%12.6f %s %s\n", seconds, event_names[event->type], event->loading ? "true" : "false");
+    else
+        printf("%12.6f %s\n", seconds, event_names[event->type]);
+    event_count++;
+}
+
+static double now_seconds()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char* argv[])
+{
+    bool profile = false;
+    int first = 1;
+    if (argc > 1 && strcmp(argv[1], "--profile") == 0) {
+        profile = true;
+        first++;
+    }
+    if (argc - first != 2) {
+        fprintf(stderr, "Usage: %s [--profile] <script.lua> <trace>\n", argv[0]);
+        return 2;
+    }
+
+    double start = now_seconds();
+    long long ticks = replay_auto_splitter(argv[first], argv[first + 1], profile, print_event);
+    double elapsed = now_seconds() - start;
+    if (ticks < 0)
+        return 1;
+
+    fprintf(stderr, "%lld ticks, %d events in %.3fs (%.0f ticks/s)\n",
+        ticks, event_count, elapsed, elapsed > 0 ? ticks / elapsed : 0);
+    return 0;
+}
@@ -0,0 +1,229 @@
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "process.h"
+#include "scheduler.h"
+
+#define NANOSECONDS 1000000000ULL
+
+int ppoll(struct pollfd* fds, nfds_t nfds, const struct timespec* timeout, const sigset_t* sigmask);
+
+/*
+    Tick n is due at origin + n * 1s / rate, computed from scratch every time
+    so rounding never adds up. A timerfd is used when possible as it wakes up
+    right at the deadline, poll timeouts get some slack added by the kernel
+*/
+static _Thread_local struct {
+    int rate;
+    enum overrun_policy policy;
+    uint64_t origin;
+    uint64_t tick;
+    uint64_t tick_start;
+    int timerfd;
+    int watch_fd;
+    bool watch_ready;
+} scheduler = { .timerfd = -1, .watch_fd = -1 };
+
+_Thread_local scheduler_stats scheduler_statistics;
+
+static const char* overrun_policy_names[] = {
+    "skip",
+    "catchup",
+    "stretch",
+};
+
+enum overrun_policy overrun_policy_from_string(const char* value)
+{
+    for (int i = 0; i < (int)(sizeof(overrun_policy_names) / sizeof(overrun_policy_names[0])); i++) {
+        if (strcmp(value, overrun_policy_names[i]) == 0)
+            return i;
+    }
+    printf("Unknown overrun policy: %s, using skip\n", value);
+    return OVERRUN_SKIP;
+}
+
+const char* overrun_policy_name(enum overrun_policy policy)
+{
+    return overrun_policy_names[policy];
+}
+
+static uint64_t now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * NANOSECONDS + time.tv_nsec;
+}
+
+static uint64_t deadline(uint64_t tick)
+{
+    return scheduler.origin + tick * NANOSECONDS / scheduler.rate;
+}
+
+void scheduler_start(int rate, enum overrun_policy policy)
+{
+    scheduler.rate = rate > 0 ? rate : 60;
+    scheduler.policy = policy;
+    scheduler.origin = now();
+    scheduler.tick = 0;
+    scheduler.tick_start = scheduler.origin;
+    if (scheduler.timerfd == -1)
+        scheduler.timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+
+    memset(&scheduler_statistics, 0, sizeof(scheduler_statistics));
+    scheduler_statistics.target_period = NANOSECONDS / scheduler.rate;
+    scheduler_statistics.min_period = UINT64_MAX;
+}
+
+void scheduler_stop()
+{
+    if (scheduler.timerfd != -1)
+        close(scheduler.timerfd);
+    scheduler.timerfd = -1;
+}
+
+/*
+    Sleeps until `wake`, or until the game exits
+    The watched fd doesn't cut the sleep short, it's only remembered as ready
+    Returns false if the game exited
+*/
+static bool sleep_until(uint64_t wake)
+{
+    int pidfd = process_fd();
+
+    if (scheduler.timerfd != -1) {
+        struct itimerspec timer = {
+            .it_value = { .tv_sec = wake / NANOSECONDS, .tv_nsec = wake % NANOSECONDS },
+        };
+        timerfd_settime(scheduler.timerfd, TFD_TIMER_ABSTIME, &timer, NULL);
+    }
+
+    for (;;) {
+        struct pollfd fds[3];
+        int fd_count = 0;
+        int pid_index = -1;
+        int timer_index = -1;
+        int watch_index = -1;
+        if (pidfd != -1) {
+            pid_index = fd_count;
+            fds[fd_count++] = (struct pollfd) { .fd = pidfd, .events = POLLIN };
+        }
+        if (scheduler.timerfd != -1) {
+            timer_index = fd_count;
+            fds[fd_count++] = (struct pollfd) { .fd = scheduler.timerfd, .events = POLLIN };
+        }
+        if (scheduler.watch_fd != -1 && !scheduler.watch_ready) {
+            watch_index = fd_count;
+            fds[fd_count++] = (struct pollfd) { .fd = scheduler.watch_fd, .events = POLLIN };
+        }
+
+        // Without a timerfd the deadline becomes a relative timeout
+        struct timespec timeout;
+        struct timespec* poll_timeout = NULL;
+        if (timer_index == -1) {
+            uint64_t current = now();
+            uint64_t remaining = wake > current ? wake - current : 0;
+            timeout.tv_sec = remaining / NANOSECONDS;
+            timeout.tv_nsec = remaining % NANOSECONDS;
+            poll_timeout = &timeout;
+        }
+
+        // Re-arming the timerfd resets its expiration count, no need to read it
+        int result = ppoll(fds, fd_count, poll_timeout, NULL);
+        if (result == -1) {
+            if (errno == EINTR)
+                continue;
+            return true;
+        }
+
+        if (pid_index != -1 && fds[pid_index].revents & POLLIN) {
+            process_mark_exited();
+            return false;
+        }
+        if (watch_index != -1 && fds[watch_index].revents)
+            scheduler.watch_ready = true;
+        if (timer_index != -1 ? fds[timer_index].revents & POLLIN : now() >= wake)
+            return true;
+    }
+}
+
+// Also polls `fd` while sleeping, -1 to stop
+void scheduler_watch_fd(int fd)
+{
+    scheduler.watch_fd = fd;
+    scheduler.watch_ready = false;
+}
+
+// Returns true once if the watched fd became readable during a sleep
+bool scheduler_fd_ready()
+{
+    bool ready = scheduler.watch_ready;
+    scheduler.watch_ready = false;
+    return ready;
+}
+
+// Nanoseconds until the next tick is due, 0 if it's already late
+uint64_t scheduler_time_left()
+{
+    if (scheduler.rate == 0)
+        return 0;
+    uint64_t due = deadline(scheduler.tick + 1);
+    uint64_t current = now();
+    return due > current ? due - current : 0;
+}
+
+/*
+    Called at the end of every tick, returns when the next one is due
+    Late ticks are handled according to the overrun policy:
+    skip waits for the next deadline that's still ahead, catchup runs the
+    missed ticks right away (up to one second worth of them) and stretch
+    starts a new schedule from the late tick
+*/
+void scheduler_wait()
+{
+    uint64_t current = now();
+    scheduler.tick++;
+    uint64_t due = deadline(scheduler.tick);
+
+    if (current >= due) {
+        scheduler_statistics.overruns++;
+        switch (scheduler.policy) {
+        case OVERRUN_CATCHUP:
+            if (current - due < NANOSECONDS)
+                break;
+            // Too far behind, skip instead
+            // fall through
+        case OVERRUN_SKIP:
+            scheduler.tick = (current - scheduler.origin) * scheduler.rate / NANOSECONDS + 1;
+            due = deadline(scheduler.tick);
+            break;
+        case OVERRUN_STRETCH:
+            scheduler.origin = current;
+            scheduler.tick = 0;
+            due = current;
+            break;
+        }
+    }
+
+    // Also called when the tick is already due, the game may have exited
+    bool running = sleep_until(due);
+
+    uint64_t tick_start = now();
+    if (!running)
+        return;
+    uint64_t period = tick_start - scheduler.tick_start;
+    scheduler.tick_start = tick_start;
+    scheduler_statistics.last_period = period;
+    scheduler_statistics.total_period += period;
+    scheduler_statistics.ticks++;
+    if (period < scheduler_statistics.min_period)
+        scheduler_statistics.min_period = period;
+    if (period > scheduler_statistics.max_period)
+        scheduler_statistics.max_period = period;
+}
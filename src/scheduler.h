@@ -0,0 +1,34 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum overrun_policy {
+    OVERRUN_SKIP, // Drop the missed ticks and wait for the next deadline
+    OVERRUN_CATCHUP, // Run the missed ticks back to back
+    OVERRUN_STRETCH, // Start a new schedule from the late tick
+};
+
+typedef struct scheduler_stats {
+    uint64_t target_period; // Nanoseconds
+    uint64_t last_period; // Nanoseconds between the start of the last two ticks
+    uint64_t min_period;
+    uint64_t max_period;
+    uint64_t total_period; // Sum of all periods, for the average
+    uint64_t ticks;
+    uint64_t overruns; // Ticks that started after their deadline
+} scheduler_stats;
+
+extern _Thread_local scheduler_stats scheduler_statistics;
+
+enum overrun_policy overrun_policy_from_string(const char* value);
+const char* overrun_policy_name(enum overrun_policy policy);
+void scheduler_start(int rate, enum overrun_policy policy);
+void scheduler_wait();
+uint64_t scheduler_time_left();
+void scheduler_watch_fd(int fd);
+bool scheduler_fd_ready();
+void scheduler_stop();
+
+#endif /* __SCHEDULER_H__ */
@@ -0,0 +1,267 @@
+#include <errno.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <lauxlib.h>
+#include <luajit.h>
+
+#include "script-cache.h"
+#include "settings.h"
+
+/*
+    Bytecode of the scripts and of the modules they require, kept in the
+    bytecode-cache directory next to settings.json
+    A cached chunk is used only if the source still has the same size,
+    modification time and contents, and if it was made by the same LuaJIT.
+    Anything else loads the source and replaces the cached chunk
+*/
+
+#define SCRIPT_CACHE_MAGIC "LSBC0001"
+
+typedef struct script_cache_header {
+    char magic[8];
+    char luajit[32]; // LUAJIT_VERSION
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t hash;
+    uint32_t path_length; // Followed by the path of the source, then the bytecode
+} script_cache_header;
+
+// FNV-1a
+static uint64_t hash_bytes(const void* data, size_t size)
+{
+    const uint8_t* bytes = data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+// Reads a whole file, the caller frees it
+static char* read_file(const char* path, size_t* size)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+    struct stat st;
+    char* data = NULL;
+    if (fstat(fileno(file), &st) == 0 && (data = malloc(st.st_size + 1)) != NULL) {
+        *size = fread(data, 1, st.st_size, file);
+        data[*size] = '\0';
+    }
+    fclose(file);
+    return data;
+}
+
+static void cache_path(const char* source_path, char* path)
+{
+    get_libresplit_folder_path(path);
+    char name[64];
+    snprintf(name, sizeof(name), "/bytecode-cache/%016llx.ljbc", (unsigned long long)hash_bytes(source_path, strlen(source_path)));
+    strcat(path, name);
+}
+
+static void fill_header(script_cache_header* header, const char* path, const struct stat* st, const char* source, size_t size)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, SCRIPT_CACHE_MAGIC, sizeof(header->magic));
+    snprintf(header->luajit, sizeof(header->luajit), "%s", LUAJIT_VERSION);
+    header->size = size;
+    header->mtime_sec = st->st_mtim.tv_sec;
+    header->mtime_nsec = st->st_mtim.tv_nsec;
+    header->hash = hash_bytes(source, size);
+    header->path_length = strlen(path);
+}
+
+/*
+    Loads the cached bytecode of `path` if it matches `header`
+    Returns false, leaving nothing on the stack, if there's none
+*/
+static bool load_cached(lua_State* L, const char* path, const script_cache_header* header, const char* chunk_name)
+{
+    char file_path[PATH_MAX];
+    cache_path(path, file_path);
+    size_t size;
+    char* data = read_file(file_path, &size);
+    if (data == NULL)
+        return false;
+
+    size_t offset = sizeof(*header) + header->path_length;
+    bool valid = size > offset
+        && memcmp(data, header, sizeof(*header)) == 0
+        && memcmp(data + sizeof(*header), path, header->path_length) == 0;
+    if (valid && luaL_loadbuffer(L, data + offset, size - offset, chunk_name) != LUA_OK) {
+        lua_pop(L, 1); // Remove the error message from the stack
+        valid = false;
+    }
+    free(data);
+    return valid;
+}
+
+static int write_chunk(lua_State* L, const void* data, size_t size, void* file)
+{
+    return fwrite(data, 1, size, file) == size ? 0 : 1;
+}
+
+// Saves the function on top of the stack, written to a temporary file first so it's never seen half written
+static void store_cached(lua_State* L, const char* path, const script_cache_header* header)
+{
+    char file_path[PATH_MAX];
+    get_libresplit_folder_path(file_path);
+    strcat(file_path, "/bytecode-cache");
+    if (mkdir(file_path, 0755) == -1) {
+        // Directory already exists or there was an error
+    }
+    cache_path(path, file_path);
+
+    char temporary_path[PATH_MAX + 8];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.XXXXXX", file_path);
+    int fd = mkstemp(temporary_path);
+    if (fd == -1)
+        return;
+    FILE* file = fdopen(fd, "wb");
+    if (file == NULL) {
+        close(fd);
+        unlink(temporary_path);
+        return;
+    }
+
+    bool written = fwrite(header, sizeof(*header), 1, file) == 1
+        && fwrite(path, 1, header->path_length, file) == header->path_length
+        && lua_dump(L, write_chunk, file) == 0;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temporary_path, file_path) == -1) {
+        printf("Couldn't write the bytecode of %s to %s: %s\n", path, file_path, strerror(errno));
+        unlink(temporary_path);
+    }
+}
+
+/*
+    Loads a script like luaL_loadfile, from the cache when possible
+    Pushes the compiled chunk, or an error message if it returns something
+    else than LUA_OK
+*/
+int script_cache_load(lua_State* L, const char* path)
+{
+    char chunk_name[PATH_MAX + 1];
+    snprintf(chunk_name, sizeof(chunk_name), "@%s", path);
+
+    struct stat st;
+    size_t size;
+    char* source = stat(path, &st) == 0 ? read_file(path, &size) : NULL;
+    if (source == NULL) {
+        lua_pushfstring(L, "cannot open %s: %s", path, strerror(errno));
+        return LUA_ERRFILE;
+    }
+
+    script_cache_header header;
+    fill_header(&header, path, &st, source, size);
+    if (load_cached(L, path, &header, chunk_name)) {
+        free(source);
+        return LUA_OK;
+    }
+
+    // Like luaL_loadfile, a first line starting with # is skipped but still counted
+    const char* code = source;
+    if (code[0] == '#') {
+        while (*code != '\0' && *code != '\n')
+            code++;
+    }
+    bool bytecode = code[0] == LUA_SIGNATURE[0];
+    int result = luaL_loadbuffer(L, code, size - (code - source), chunk_name);
+    free(source);
+    if (result == LUA_OK && !bytecode)
+        store_cached(L, path, &header);
+    return result;
+}
+
+static char loading_key; // Marks the modules that are being loaded
+
+static bool valid_module_name(const char* name)
+{
+    if (name[0] == '\0' || name[0] == '.')
+        return false;
+    for (const char* c = name; *c != '\0'; c++) {
+        bool allowed = (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || *c == '_' || *c == '-' || *c == '.';
+        if (!allowed || (*c == '.' && (c[1] == '.' || c[1] == '\0')))
+            return false;
+    }
+    return true;
+}
+
+/*
+    Lua: require("name")
+    Loads `name`.lua from the auto-splitters directory once per script and
+    returns what it returned, dots in the name are subdirectories. Nothing
+    outside of the auto-splitters directory can be loaded, symbolic links
+    included
+*/
+int script_require(lua_State* L)
+{
+    const char* name = luaL_checkstring(L, 1);
+    if (!valid_module_name(name))
+        return luaL_error(L, "require: invalid module name '%s'", name);
+
+    lua_getfield(L, LUA_REGISTRYINDEX, "libresplit_modules");
+    if (!lua_istable(L, -1)) {
+        lua_pop(L, 1); // Remove the nil from the stack
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, "libresplit_modules");
+    }
+    int modules = lua_gettop(L);
+    lua_getfield(L, modules, name);
+    if (lua_touserdata(L, -1) == &loading_key)
+        return luaL_error(L, "require: '%s' requires itself", name);
+    if (!lua_isnil(L, -1))
+        return 1;
+    lua_pop(L, 1); // Remove the nil from the stack
+
+    char directory[PATH_MAX];
+    get_libresplit_folder_path(directory);
+    strcat(directory, "/auto-splitters");
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/%s.lua", directory, name) >= (int)sizeof(path))
+        return luaL_error(L, "require: module name '%s' is too long", name);
+    for (char* c = path + strlen(directory) + 1; *c != '\0'; c++) {
+        if (*c == '.' && strcmp(c, ".lua") != 0)
+            *c = '/';
+    }
+
+    char real_directory[PATH_MAX];
+    char real_path[PATH_MAX];
+    if (realpath(directory, real_directory) == NULL || realpath(path, real_path) == NULL)
+        return luaL_error(L, "require: module '%s' not found in %s", name, directory);
+    size_t directory_length = strlen(real_directory);
+    if (strncmp(real_path, real_directory, directory_length) != 0 || real_path[directory_length] != '/')
+        return luaL_error(L, "require: '%s' is outside of %s", name, directory);
+
+    lua_pushlightuserdata(L, &loading_key);
+    lua_setfield(L, modules, name);
+    if (script_cache_load(L, real_path) != LUA_OK) {
+        lua_pushnil(L);
+        lua_setfield(L, modules, name);
+        return luaL_error(L, "require: %s", lua_tostring(L, -1));
+    }
+    lua_pushstring(L, name);
+    if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+        // It can be required again once it's fixed
+        lua_pushnil(L);
+        lua_setfield(L, modules, name);
+        return lua_error(L);
+    }
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1); // Remove the nil from the stack
+        lua_pushboolean(L, 1);
+    }
+    lua_pushvalue(L, -1);
+    lua_setfield(L, modules, name);
+    return 1;
+}
@@ -0,0 +1,9 @@
+#ifndef __SCRIPT_CACHE_H__
+#define __SCRIPT_CACHE_H__
+
+#include <luajit.h>
+
+int script_cache_load(lua_State* L, const char* path);
+int script_require(lua_State* L);
+
+#endif /* __SCRIPT_CACHE_H__ */
@@ -0,0 +1,323 @@
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <jansson.h>
+#include <lauxlib.h>
+#include <luajit.h>
+
+#include "memory-backend.h"
+#include "process.h"
+#include "settings.h"
+#include "sigscan.h"
+
+#define SIGSCAN_CHUNK_SIZE (1024 * 1024)
+#define SIGSCAN_MAX_REGIONS 256
+
+extern _Thread_local game_process process;
+
+// Results of previous scans, see `sigscan_cache_key`
+// Shared by all auto splitter instances, only touched with the lock held
+static json_t* sigscan_cache = NULL;
+static pthread_mutex_t sigscan_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/*
+    Parses a signature made of hex bytes and `??` wildcards
+    Spaces between bytes are optional, a lone `?` is a whole byte wildcard
+    and `4?` or `?4` only match half of the byte
+*/
+bool sigscan_parse(const char* signature, sigscan_pattern* pattern)
+{
+    pattern->length = 0;
+    const char* c = signature;
+    while (*c) {
+        if (*c == ' ') {
+            c++;
+            continue;
+        }
+        if (pattern->length == SIGSCAN_MAX_LENGTH)
+            return false;
+
+        uint8_t byte = 0;
+        uint8_t mask = 0;
+        if (c[0] == '?' && (c[1] == '\0' || c[1] == ' ')) {
+            c++;
+        } else {
+            for (int nibble = 0; nibble < 2; nibble++) {
+                int shift = nibble == 0 ? 4 : 0;
+                if (c[nibble] == '?')
+                    continue;
+                int value = hex_value(c[nibble]);
+                if (value < 0)
+                    return false;
+                byte |= value << shift;
+                mask |= 0xF << shift;
+            }
+            c += 2;
+        }
+        pattern->bytes[pattern->length] = byte;
+        pattern->mask[pattern->length] = mask;
+        pattern->length++;
+    }
+    return pattern->length > 0;
+}
+
+// Writes the signature in a canonical form, used as the cache key
+static void sigscan_format(const sigscan_pattern* pattern, char* out)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    for (int i = 0; i < pattern->length; i++) {
+        *out++ = pattern->mask[i] & 0xF0 ? digits[pattern->bytes[i] >> 4] : '?';
+        *out++ = pattern->mask[i] & 0x0F ? digits[pattern->bytes[i] & 0xF] : '?';
+        *out++ = i + 1 < pattern->length ? ' ' : '\0';
+    }
+}
+
+static bool sigscan_match(const uint8_t* data, const sigscan_pattern* pattern)
+{
+    for (int i = 0; i < pattern->length; i++) {
+        if ((data[i] & pattern->mask[i]) != pattern->bytes[i])
+            return false;
+    }
+    return true;
+}
+
+/*
+    Finds the first match of `pattern` in `data`
+    The first and last fully known bytes of the pattern are used as anchors,
+    16 candidate positions are tested against both at once and only the ones
+    that pass are compared byte by byte
+    Returns the offset of the match, -1 if there is none
+*/
+int64_t sigscan_find(const uint8_t* data, size_t size, const sigscan_pattern* pattern)
+{
+    size_t length = pattern->length;
+    if (length == 0 || size < length)
+        return -1;
+    size_t last = size - length; // Last position a match can start at
+
+    int first_anchor = -1;
+    int last_anchor = -1;
+    for (int i = 0; i < pattern->length; i++) {
+        if (pattern->mask[i] == 0xFF) {
+            if (first_anchor < 0)
+                first_anchor = i;
+            last_anchor = i;
+        }
+    }
+
+    size_t i = 0;
+    if (first_anchor >= 0) {
+#if defined(__SSE2__)
+        __m128i first = _mm_set1_epi8((char)pattern->bytes[first_anchor]);
+        __m128i second = _mm_set1_epi8((char)pattern->bytes[last_anchor]);
+        for (; i + 15 <= last; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(data + i + first_anchor));
+            __m128i b = _mm_loadu_si128((const __m128i*)(data + i + last_anchor));
+            unsigned bits = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, second)));
+            while (bits) {
+                int bit = __builtin_ctz(bits);
+                if (sigscan_match(data + i + bit, pattern))
+                    return i + bit;
+                bits &= bits - 1;
+            }
+        }
+#endif
+        while (i <= last) {
+            const uint8_t* candidate = memchr(data + i + first_anchor, pattern->bytes[first_anchor], last - i + 1);
+            if (candidate == NULL)
+                return -1;
+            i = candidate - data - first_anchor;
+            if (sigscan_match(data + i, pattern))
+                return i;
+            i++;
+        }
+        return -1;
+    }
+
+    for (; i <= last; i++) {
+        if (sigscan_match(data + i, pattern))
+            return i;
+    }
+    return -1;
+}
+
+/*
+    Scans the readable regions of a module in large chunks
+    Consecutive chunks overlap by the pattern length so no match is missed
+    Returns the address of the first match, 0 if there is none
+*/
+static uint64_t sigscan_regions(const module_region* regions, int count, const sigscan_pattern* pattern)
+{
+    uint8_t* buffer = malloc(SIGSCAN_CHUNK_SIZE);
+    if (buffer == NULL)
+        return 0;
+
+    uint64_t found = 0;
+    for (int r = 0; r < count && !found; r++) {
+        if (!regions[r].readable)
+            continue;
+        uint64_t position = regions[r].start;
+        while (position < regions[r].end) {
+            uint64_t size = regions[r].end - position;
+            if (size > SIGSCAN_CHUNK_SIZE)
+                size = SIGSCAN_CHUNK_SIZE;
+            if (size < (uint64_t)pattern->length)
+                break;
+
+            struct iovec local = { buffer, size };
+            struct iovec remote = { (void*)(uintptr_t)position, size };
+            int32_t error = 0;
+            memory_backend_read(process.pid, &local, &remote, &error, 1);
+            if (!error) {
+                int64_t offset = sigscan_find(buffer, size, pattern);
+                if (offset >= 0) {
+                    found = position + offset;
+                    break;
+                }
+            }
+
+            if (position + size >= regions[r].end)
+                break;
+            position += size - (pattern->length - 1);
+        }
+    }
+
+    free(buffer);
+    return found;
+}
+
+static void sigscan_cache_path(char* path)
+{
+    get_libresplit_folder_path(path);
+    strcat(path, "/sigscan-cache.json");
+}
+
+/*
+    Scans are cached per module file, keyed by its path, size and
+    modification time, so a different build of the game is scanned again
+*/
+static bool sigscan_cache_key(const char* module_path, char* key, size_t key_size)
+{
+    struct stat st;
+    if (module_path[0] != '/' || stat(module_path, &st) == -1)
+        return false;
+    snprintf(key, key_size, "%s:%lld:%lld", module_path, (long long)st.st_size, (long long)st.st_mtime);
+    return true;
+}
+
+static json_t* sigscan_cache_module(const char* key, bool create)
+{
+    if (sigscan_cache == NULL) {
+        char path[PATH_MAX];
+        json_error_t error;
+        sigscan_cache_path(path);
+        sigscan_cache = json_load_file(path, 0, &error);
+        if (sigscan_cache == NULL || !json_is_object(sigscan_cache)) {
+            if (sigscan_cache != NULL)
+                json_decref(sigscan_cache);
+            sigscan_cache = json_object();
+        }
+    }
+
+    json_t* module = json_object_get(sigscan_cache, key);
+    if (module == NULL && create) {
+        module = json_object();
+        json_object_set_new(sigscan_cache, key, module);
+    }
+    return module;
+}
+
+static void sigscan_cache_save()
+{
+    char path[PATH_MAX];
+    sigscan_cache_path(path);
+    if (json_dump_file(sigscan_cache, path, JSON_INDENT(4)) != 0) {
+        printf("Failed to save the signature scan cache to %s\n", path);
+    }
+}
+
+/*
+    Lua: sigScan(module, signature, offset)
+    Returns the offset of the first match (plus `offset`) relative to the
+    base address of the module, or nil if the signature wasn't found
+*/
+int sig_scan(lua_State* L)
+{
+    const char* module = luaL_checkstring(L, 1);
+    const char* signature = luaL_checkstring(L, 2);
+    lua_Integer offset = luaL_optinteger(L, 3, 0);
+
+    sigscan_pattern pattern;
+    if (!sigscan_parse(signature, &pattern))
+        return luaL_error(L, "sigScan: invalid signature '%s'", signature);
+
+    module_region* regions = malloc(SIGSCAN_MAX_REGIONS * sizeof(module_region));
+    if (regions == NULL)
+        return luaL_error(L, "sigScan: out of memory");
+    char module_path[PATH_MAX] = { 0 };
+    int count = find_module_regions(module, regions, SIGSCAN_MAX_REGIONS, module_path, sizeof(module_path));
+    if (count == 0) {
+        free(regions);
+        printf("sigScan: couldn't find module %s\n", module);
+        lua_pushnil(L);
+        return 1;
+    }
+
+    char normalized[SIGSCAN_MAX_LENGTH * 3];
+    sigscan_format(&pattern, normalized);
+    char key[PATH_MAX + 64];
+    bool cacheable = sigscan_cache_key(module_path, key, sizeof(key));
+
+    if (cacheable) {
+        pthread_mutex_lock(&sigscan_cache_lock);
+        json_t* cached = json_object_get(sigscan_cache_module(key, false), normalized);
+        bool hit = json_is_integer(cached);
+        long long cached_offset = hit ? json_integer_value(cached) : 0;
+        pthread_mutex_unlock(&sigscan_cache_lock);
+        if (hit) {
+            free(regions);
+            lua_pushnumber(L, (lua_Number)(cached_offset + offset));
+            return 1;
+        }
+    }
+
+    uint64_t address = sigscan_regions(regions, count, &pattern);
+    uint64_t base = regions[0].start;
+    free(regions);
+    if (address == 0) {
+        printf("sigScan: no match for %s in %s\n", normalized, module);
+        lua_pushnil(L);
+        return 1;
+    }
+
+    if (cacheable) {
+        pthread_mutex_lock(&sigscan_cache_lock);
+        json_object_set_new(sigscan_cache_module(key, true), normalized, json_integer(address - base));
+        sigscan_cache_save();
+        pthread_mutex_unlock(&sigscan_cache_lock);
+    }
+
+    lua_pushnumber(L, (lua_Number)(address - base + offset));
+    return 1;
+}
@@ -0,0 +1,27 @@
+#ifndef __SIGSCAN_H__
+#define __SIGSCAN_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <luajit.h>
+
+#define SIGSCAN_MAX_LENGTH 256
+
+/*
+    A byte signature like "48 8B 05 ?? ?? ?? ??"
+    A byte matches when `(byte & mask) == bytes`, so wildcards have a mask of
+    0 and half wildcards like "4?" have a mask of 0xF0
+*/
+typedef struct sigscan_pattern {
+    uint8_t bytes[SIGSCAN_MAX_LENGTH];
+    uint8_t mask[SIGSCAN_MAX_LENGTH];
+    int length;
+} sigscan_pattern;
+
+bool sigscan_parse(const char* signature, sigscan_pattern* pattern);
+int64_t sigscan_find(const uint8_t* data, size_t size, const sigscan_pattern* pattern);
+int sig_scan(lua_State* L);
+
+#endif /* __SIGSCAN_H__ */
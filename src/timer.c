@@ -348,6 +348,7 @@ static void reset_timer(ls_timer* timer)
     int size;
     timer->started = 0;
     timer->start_time = 0;
+    timer->event_time = 0;
     timer->curr_split = 0;
     timer->time = -timer->game->start_delay;
     size = timer->game->split_count * sizeof(long long);
@@ -439,58 +440,81 @@ timer_create_done:
     return error;
 }
 
-void ls_timer_step(ls_timer* timer, long long now)
+// Updates the current split's time, deltas and info from timer->time
+static void update_current_split(ls_timer* timer)
 {
-    timer->now = now;
-    if (timer->running) {
-        long long delta = timer->now - timer->start_time;
-        timer->time += delta; // Accumulate the elapsed time
-        if (timer->curr_split < timer->game->split_count) {
-            timer->split_times[timer->curr_split] = timer->time;
-            // calc delta
-            if (timer->game->split_times[timer->curr_split]) {
-                timer->split_deltas[timer->curr_split] = timer->split_times[timer->curr_split]
-                    - timer->game->split_times[timer->curr_split];
+    if (timer->curr_split < timer->game->split_count) {
+        timer->split_times[timer->curr_split] = timer->time;
+        // calc delta
+        if (timer->game->split_times[timer->curr_split]) {
+            timer->split_deltas[timer->curr_split] = timer->split_times[timer->curr_split]
+                - timer->game->split_times[timer->curr_split];
+        }
+        // check for behind time
+        if (timer->split_deltas[timer->curr_split] > 0) {
+            timer->split_info[timer->curr_split] |= LS_INFO_BEHIND_TIME;
+        } else {
+            timer->split_info[timer->curr_split] &= ~LS_INFO_BEHIND_TIME;
+        }
+        if (!timer->curr_split || timer->split_times[timer->curr_split - 1]) {
+            // calc segment time and delta
+            timer->segment_times[timer->curr_split] = timer->split_times[timer->curr_split];
+            if (timer->curr_split) {
+                timer->segment_times[timer->curr_split] -= timer->split_times[timer->curr_split - 1];
             }
-            // check for behind time
-            if (timer->split_deltas[timer->curr_split] > 0) {
-                timer->split_info[timer->curr_split] |= LS_INFO_BEHIND_TIME;
-            } else {
-                timer->split_info[timer->curr_split] &= ~LS_INFO_BEHIND_TIME;
+            if (timer->game->segment_times[timer->curr_split]) {
+                timer->segment_deltas[timer->curr_split] = timer->segment_times[timer->curr_split]
+                    - timer->game->segment_times[timer->curr_split];
             }
-            if (!timer->curr_split || timer->split_times[timer->curr_split - 1]) {
-                // calc segment time and delta
-                timer->segment_times[timer->curr_split] = timer->split_times[timer->curr_split];
-                if (timer->curr_split) {
-                    timer->segment_times[timer->curr_split] -= timer->split_times[timer->curr_split - 1];
-                }
-                if (timer->game->segment_times[timer->curr_split]) {
-                    timer->segment_deltas[timer->curr_split] = timer->segment_times[timer->curr_split]
-                        - timer->game->segment_times[timer->curr_split];
-                }
-            }
-            // check for losing time
-            if (timer->curr_split) {
-                if (timer->split_deltas[timer->curr_split]
-                    > timer->split_deltas[timer->curr_split - 1]) {
-                    timer->split_info[timer->curr_split]
-                        |= LS_INFO_LOSING_TIME;
-                } else {
-                    timer->split_info[timer->curr_split]
-                        &= ~LS_INFO_LOSING_TIME;
-                }
-            } else if (timer->split_deltas[timer->curr_split] > 0) {
+        }
+        // check for losing time
+        if (timer->curr_split) {
+            if (timer->split_deltas[timer->curr_split]
+                > timer->split_deltas[timer->curr_split - 1]) {
                 timer->split_info[timer->curr_split]
                     |= LS_INFO_LOSING_TIME;
             } else {
                 timer->split_info[timer->curr_split]
                     &= ~LS_INFO_LOSING_TIME;
             }
+        } else if (timer->split_deltas[timer->curr_split] > 0) {
+            timer->split_info[timer->curr_split]
+                |= LS_INFO_LOSING_TIME;
+        } else {
+            timer->split_info[timer->curr_split]
+                &= ~LS_INFO_LOSING_TIME;
         }
     }
+}
+
+void ls_timer_step(ls_timer* timer, long long now)
+{
+    timer->now = now;
+    if (timer->running) {
+        long long delta = timer->now - timer->start_time;
+        timer->time += delta; // Accumulate the elapsed time
+        update_current_split(timer);
+    }
     timer->start_time = now; // Update the start time for the next iteration
 }
 
+/*
+    Brings the timer to the state it had at `time`, which may be before the
+    last step. It can't go back past the last start, split or pause, what
+    they recorded would end up ahead of the timer
+*/
+static void advance_to(ls_timer* timer, long long time)
+{
+    if (time < timer->event_time) {
+        time = timer->event_time;
+    }
+    if (timer->running) {
+        timer->time += time - timer->start_time;
+        update_current_split(timer);
+    }
+    timer->start_time = time;
+}
+
 int ls_timer_start(ls_timer* timer)
 {
     if (timer->curr_split < timer->game->split_count) {
@@ -498,11 +522,45 @@ int ls_timer_start(ls_timer* timer)
             ++*timer->attempt_count;
             timer->started = 1;
         }
+        if (!timer->running) {
+            timer->event_time = timer->start_time;
+        }
         timer->running = 1;
     }
     return timer->running;
 }
 
+/*
+    The _at variants act at `time` (as returned by ls_time_now) instead of
+    at the last step, so the split and segment times, deltas and golds are
+    exact even when the event is handled late
+*/
+int ls_timer_start_at(ls_timer* timer, long long time)
+{
+    if (!timer->running) {
+        // Resuming before the pause would count the paused time
+        timer->start_time = time < timer->event_time ? timer->event_time : time;
+    }
+    return ls_timer_start(timer);
+}
+
+int ls_timer_split_at(ls_timer* timer, long long time)
+{
+    if (!timer->running) {
+        return 0;
+    }
+    advance_to(timer, time);
+    return ls_timer_split(timer);
+}
+
+void ls_timer_pause_at(ls_timer* timer, long long time)
+{
+    if (timer->running) {
+        advance_to(timer, time);
+        ls_timer_stop(timer);
+    }
+}
+
 int ls_timer_split(ls_timer* timer)
 {
 
@@ -537,6 +595,7 @@ int ls_timer_split(ls_timer* timer)
                 }
             }
             ++timer->curr_split;
+            timer->event_time = timer->start_time;
             // stop timer if last split
             if (timer->curr_split == timer->game->split_count) {
                 // Increment finished_count
@@ -587,6 +646,9 @@ int ls_timer_unsplit(ls_timer* timer)
 
 void ls_timer_stop(ls_timer* timer)
 {
+    if (timer->running) {
+        timer->event_time = timer->start_time;
+    }
     timer->running = 0;
 }
 
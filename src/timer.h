@@ -32,6 +32,7 @@ struct ls_timer {
     int loading;
     long long now;
     long long start_time;
+    long long event_time; // When the timer was last started, split or paused
     long long time;
     long long sum_of_bests;
     long long world_record;
@@ -81,6 +82,12 @@ void ls_timer_step(ls_timer* timer, long long now);
 
 int ls_timer_split(ls_timer* timer);
 
+int ls_timer_start_at(ls_timer* timer, long long time);
+
+int ls_timer_split_at(ls_timer* timer, long long time);
+
+void ls_timer_pause_at(ls_timer* timer, long long time);
+
 int ls_timer_skip(ls_timer* timer);
 
 int ls_timer_unsplit(ls_timer* timer);
@@ -0,0 +1,377 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory-backend.h"
+#include "trace.h"
+
+/*
+    Last known result of every (address, size) pair that was read
+    The recorder only writes reads whose result changed, the replayer keeps
+    the same table up to date from the trace and answers reads out of it
+*/
+typedef struct trace_value {
+    uint64_t address;
+    uint32_t size; // 0 when the slot is empty
+    int32_t error;
+    uint8_t* data;
+} trace_value;
+
+typedef struct trace_values {
+    trace_value* slots;
+    uint32_t mask;
+    uint32_t count;
+} trace_values;
+
+static uint32_t value_hash(uint64_t address, uint32_t size)
+{
+    uint64_t hash = (address ^ ((uint64_t)size << 48)) * 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(hash >> 32);
+}
+
+static void values_free(trace_values* values)
+{
+    for (uint32_t i = 0; values->slots != NULL && i <= values->mask; i++)
+        free(values->slots[i].data);
+    free(values->slots);
+    memset(values, 0, sizeof(*values));
+}
+
+static trace_value* values_slot(trace_value* slots, uint32_t mask, uint64_t address, uint32_t size)
+{
+    uint32_t i = value_hash(address, size) & mask;
+    while (slots[i].size != 0 && (slots[i].address != address || slots[i].size != size))
+        i = (i + 1) & mask;
+    return &slots[i];
+}
+
+// Finds the value of a pair, NULL if it was never read
+static trace_value* values_find(trace_values* values, uint64_t address, uint32_t size)
+{
+    if (values->slots == NULL)
+        return NULL;
+    trace_value* value = values_slot(values->slots, values->mask, address, size);
+    return value->size != 0 ? value : NULL;
+}
+
+static bool values_grow(trace_values* values)
+{
+    uint32_t capacity = values->slots != NULL ? (values->mask + 1) * 2 : 1024;
+    trace_value* slots = calloc(capacity, sizeof(trace_value));
+    if (slots == NULL)
+        return false;
+    for (uint32_t i = 0; values->slots != NULL && i <= values->mask; i++) {
+        if (values->slots[i].size != 0)
+            *values_slot(slots, capacity - 1, values->slots[i].address, values->slots[i].size) = values->slots[i];
+    }
+    free(values->slots);
+    values->slots = slots;
+    values->mask = capacity - 1;
+    return true;
+}
+
+// Stores the result of a read, returns true if it's different from the previous one
+static bool values_store(trace_values* values, uint64_t address, uint32_t size, int32_t error, const void* data)
+{
+    trace_value* value = values_find(values, address, size);
+    if (value != NULL) {
+        if (value->error == error && (error != 0 || memcmp(value->data, data, size) == 0))
+            return false;
+    } else {
+        if ((values->count + 1) * 2 > (values->slots != NULL ? values->mask + 1 : 0) && !values_grow(values))
+            return true;
+        value = values_slot(values->slots, values->mask, address, size);
+        value->address = address;
+        value->size = size;
+        value->data = malloc(size);
+        if (value->data == NULL) {
+            value->size = 0;
+            return true;
+        }
+        values->count++;
+    }
+    value->error = error;
+    if (error == 0)
+        memcpy(value->data, data, size);
+    return true;
+}
+
+/*
+    Recording
+    Only one trace is recorded per thread, every auto splitter instance
+    records its own
+*/
+static _Thread_local struct {
+    FILE* file;
+    trace_values values;
+} recorder = { 0 };
+
+static void write_type(uint8_t type)
+{
+    fwrite(&type, sizeof(type), 1, recorder.file);
+}
+
+static void record_reads(const struct iovec* local, const struct iovec* remote, const int32_t* errors, int count)
+{
+    for (int i = 0; i < count; i++) {
+        uint64_t address = (uintptr_t)remote[i].iov_base;
+        uint32_t size = (uint32_t)remote[i].iov_len;
+        int32_t error = errors[i];
+        if (size == 0 || !values_store(&recorder.values, address, size, error, local[i].iov_base))
+            continue;
+        write_type(TRACE_READ);
+        fwrite(&address, sizeof(address), 1, recorder.file);
+        fwrite(&size, sizeof(size), 1, recorder.file);
+        fwrite(&error, sizeof(error), 1, recorder.file);
+        if (error == 0)
+            fwrite(local[i].iov_base, 1, size, recorder.file);
+    }
+}
+
+bool trace_record_start(const char* path)
+{
+    trace_record_stop();
+    recorder.file = fopen(path, "wb");
+    if (recorder.file == NULL) {
+        printf("Couldn't record a trace to %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), recorder.file);
+    memory_backend_observe(record_reads);
+    printf("Recording a trace to %s\n", path);
+    return true;
+}
+
+void trace_record_stop()
+{
+    if (recorder.file == NULL)
+        return;
+    memory_backend_observe(NULL);
+    fclose(recorder.file);
+    recorder.file = NULL;
+    values_free(&recorder.values);
+}
+
+bool trace_recording()
+{
+    return recorder.file != NULL;
+}
+
+void trace_record_process(int pid, uint64_t base_address)
+{
+    if (recorder.file == NULL)
+        return;
+    int32_t pid_value = pid;
+    write_type(TRACE_PROCESS);
+    fwrite(&pid_value, sizeof(pid_value), 1, recorder.file);
+    fwrite(&base_address, sizeof(base_address), 1, recorder.file);
+}
+
+void trace_record_maps(const char* maps, size_t length)
+{
+    if (recorder.file == NULL)
+        return;
+    uint32_t length_value = (uint32_t)length;
+    write_type(TRACE_MAPS);
+    fwrite(&length_value, sizeof(length_value), 1, recorder.file);
+    fwrite(maps, 1, length, recorder.file);
+}
+
+void trace_record_tick(long long time)
+{
+    if (recorder.file == NULL)
+        return;
+    int64_t time_value = time;
+    write_type(TRACE_TICK);
+    fwrite(&time_value, sizeof(time_value), 1, recorder.file);
+}
+
+/*
+    Replaying
+    The records that follow a tick are applied before the tick runs, they're
+    what the script read during that tick
+*/
+static _Thread_local struct {
+    FILE* file;
+    trace_values values;
+    bool has_tick;
+    long long tick_time; // Next tick, read ahead while applying the previous one
+    char* maps;
+    bool has_process;
+    int pid;
+    uint64_t base_address;
+} replayer = { 0 };
+
+static bool read_value(void* value, size_t size)
+{
+    return fread(value, 1, size, replayer.file) == size;
+}
+
+/*
+    Applies records until the next tick
+    Returns false at the end of the trace or if it's truncated
+*/
+static bool apply_records()
+{
+    replayer.has_tick = false;
+    uint8_t type;
+    while (read_value(&type, sizeof(type))) {
+        switch (type) {
+            case TRACE_PROCESS: {
+                int32_t pid;
+                if (!read_value(&pid, sizeof(pid)) || !read_value(&replayer.base_address, sizeof(replayer.base_address)))
+                    return false;
+                replayer.pid = pid;
+                replayer.has_process = true;
+                break;
+            }
+            case TRACE_MAPS: {
+                uint32_t length;
+                if (!read_value(&length, sizeof(length)))
+                    return false;
+                char* maps = malloc(length + 1);
+                if (maps == NULL || !read_value(maps, length)) {
+                    free(maps);
+                    return false;
+                }
+                maps[length] = '\0';
+                free(replayer.maps);
+                replayer.maps = maps;
+                break;
+            }
+            case TRACE_TICK: {
+                int64_t time;
+                if (!read_value(&time, sizeof(time)))
+                    return false;
+                replayer.tick_time = time;
+                replayer.has_tick = true;
+                return true;
+            }
+            case TRACE_READ: {
+                uint64_t address;
+                uint32_t size;
+                int32_t error;
+                if (!read_value(&address, sizeof(address)) || !read_value(&size, sizeof(size)) || !read_value(&error, sizeof(error)))
+                    return false;
+                uint8_t* data = NULL;
+                if (error == 0) {
+                    data = malloc(size);
+                    if (data == NULL || !read_value(data, size)) {
+                        free(data);
+                        return false;
+                    }
+                }
+                values_store(&replayer.values, address, size, error, data);
+                free(data);
+                break;
+            }
+            default:
+                printf("Unknown record %d in the trace\n", type);
+                return false;
+        }
+    }
+    return false;
+}
+
+static bool replay_attach(int pid)
+{
+    return true;
+}
+
+static void replay_detach()
+{
+}
+
+// Reads that weren't recorded fail like unmapped memory
+static void replay_read(struct iovec* local, struct iovec* remote, int32_t* errors, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (remote[i].iov_len == 0) {
+            errors[i] = 0;
+            continue;
+        }
+        trace_value* value = values_find(&replayer.values, (uintptr_t)remote[i].iov_base, (uint32_t)remote[i].iov_len);
+        if (value == NULL) {
+            errors[i] = EFAULT;
+            continue;
+        }
+        errors[i] = value->error;
+        if (value->error == 0)
+            memcpy(local[i].iov_base, value->data, value->size);
+    }
+}
+
+static const memory_backend replay_backend = {
+    "replay",
+    replay_attach,
+    replay_detach,
+    replay_read,
+};
+
+/*
+    Opens a trace and makes the reads of this thread come from it
+    Everything recorded before the first tick is applied right away, it's
+    what the script read while it was loading
+*/
+bool trace_replay_open(const char* path)
+{
+    trace_replay_close();
+    replayer.file = fopen(path, "rb");
+    if (replayer.file == NULL) {
+        printf("Couldn't open the trace %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    char magic[sizeof(TRACE_MAGIC) - 1];
+    if (!read_value(magic, sizeof(magic)) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+        printf("%s isn't a trace\n", path);
+        trace_replay_close();
+        return false;
+    }
+    memory_backend_override(&replay_backend);
+    apply_records();
+    return true;
+}
+
+void trace_replay_close()
+{
+    if (replayer.file == NULL)
+        return;
+    memory_backend_override(NULL);
+    fclose(replayer.file);
+    values_free(&replayer.values);
+    free(replayer.maps);
+    memset(&replayer, 0, sizeof(replayer));
+}
+
+bool trace_replaying()
+{
+    return replayer.file != NULL;
+}
+
+// Moves to the next tick, returns false once the trace is over
+bool trace_replay_next_tick(long long* time)
+{
+    if (!replayer.has_tick)
+        return false;
+    *time = replayer.tick_time;
+    apply_records();
+    // The last tick still runs, has_tick tells if there's another one
+    return true;
+}
+
+// The process the trace was recorded from, false if it wasn't attached yet
+bool trace_replay_process(int* pid, uint64_t* base_address)
+{
+    if (!replayer.has_process)
+        return false;
+    *pid = replayer.pid;
+    *base_address = replayer.base_address;
+    return true;
+}
+
+// Copy of the last recorded /proc/pid/maps, the caller frees it
+char* trace_replay_maps()
+{
+    return replayer.maps != NULL ? strdup(replayer.maps) : NULL;
+}
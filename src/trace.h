@@ -0,0 +1,37 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Traces of everything an auto splitter read from a game
+    A recording can be replayed later to run a script without the game
+*/
+
+#define TRACE_MAGIC "LSTRACE1"
+
+// Every record starts with its type, the values are in native byte order
+enum trace_record_type {
+    TRACE_PROCESS = 1, // int32 pid, uint64 base address
+    TRACE_MAPS = 2, // uint32 length, the text of /proc/pid/maps
+    TRACE_TICK = 3, // int64 ls_time_now() at the start of the tick
+    TRACE_READ = 4, // uint64 address, uint32 size, int32 error, the bytes if error is 0
+};
+
+bool trace_record_start(const char* path);
+void trace_record_stop();
+bool trace_recording();
+void trace_record_process(int pid, uint64_t base_address);
+void trace_record_maps(const char* maps, size_t length);
+void trace_record_tick(long long time);
+
+bool trace_replay_open(const char* path);
+void trace_replay_close();
+bool trace_replaying();
+bool trace_replay_next_tick(long long* time);
+bool trace_replay_process(int* pid, uint64_t* base_address);
+char* trace_replay_maps();
+
+#endif /* __TRACE_H__ */
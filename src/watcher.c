@@ -0,0 +1,267 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lauxlib.h>
+#include <luajit.h>
+
+#include "memory.h"
+#include "process.h"
+#include "watcher.h"
+
+/*
+    Watchers are pointer paths declared once by the script (usually in
+    `startup`), they are all read natively in one batch at the start of every
+    tick and exposed to Lua through the `current` and `old` global tables
+*/
+typedef struct watcher {
+    char* name;
+    char* module; // NULL when the path starts at the main module
+    int64_t module_offset;
+    uint64_t base;
+    uint32_t generation; // Of the module index `base` was found with
+} watcher;
+
+/*
+    Every lua_State has its own set, kept in its registry, so a reloaded
+    script doesn't see the watchers of the one it replaces
+*/
+typedef struct watcher_set {
+    watcher* watchers;
+    memory_read* reads; // Values of the current tick
+    memory_read* previous; // Values of the previous tick
+    int count;
+    int capacity;
+    bool primed;
+    bool fresh; // Primed by the last update, there was nothing to compare against
+    // The two tables swap roles every tick, so `old` never has to be copied
+    int current_ref;
+    int old_ref;
+} watcher_set;
+
+static char watcher_set_key;
+
+static watcher_set* get_watcher_set(lua_State* L, bool create)
+{
+    lua_pushlightuserdata(L, &watcher_set_key);
+    lua_rawget(L, LUA_REGISTRYINDEX);
+    watcher_set* set = lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (set != NULL || !create)
+        return set;
+
+    set = calloc(1, sizeof(watcher_set));
+    if (set == NULL)
+        return NULL;
+    set->current_ref = LUA_NOREF;
+    set->old_ref = LUA_NOREF;
+    lua_pushlightuserdata(L, &watcher_set_key);
+    lua_pushlightuserdata(L, set);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+    return set;
+}
+
+static int find_watcher(const watcher_set* set, const char* name)
+{
+    for (int i = 0; i < set->count; i++) {
+        if (strcmp(set->watchers[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static bool grow_watchers(watcher_set* set)
+{
+    int capacity = set->capacity ? set->capacity * 2 : 16;
+    watcher* new_watchers = realloc(set->watchers, capacity * sizeof(watcher));
+    if (new_watchers == NULL)
+        return false;
+    set->watchers = new_watchers;
+    memory_read* new_reads = realloc(set->reads, capacity * sizeof(memory_read));
+    if (new_reads == NULL)
+        return false;
+    set->reads = new_reads;
+    memory_read* new_previous = realloc(set->previous, capacity * sizeof(memory_read));
+    if (new_previous == NULL)
+        return false;
+    set->previous = new_previous;
+    set->capacity = capacity;
+    return true;
+}
+
+/*
+    Lua: watch("name", type, module/offset, offsets...)
+    Declares a watched value, the arguments after the name are the same as
+    the ones of `readAddress`
+*/
+int watch(lua_State* L)
+{
+    const char* name = luaL_checkstring(L, 1);
+    int top = lua_gettop(L);
+
+    memory_read read;
+    if (top < 3 || !parse_memory_read(L, 2, top, &read))
+        return luaL_error(L, "watch: invalid address for '%s'", name);
+
+    watcher entry = { 0 };
+    if (lua_type(L, 3) == LUA_TSTRING) {
+        entry.module = strdup(lua_tostring(L, 3));
+        entry.module_offset = lua_tointeger(L, 4);
+        entry.generation = module_index_generation();
+    } else {
+        entry.module_offset = lua_tointeger(L, 3);
+    }
+    entry.base = read.address - entry.module_offset;
+
+    watcher_set* set = get_watcher_set(L, true);
+    if (set == NULL) {
+        free(entry.module);
+        return luaL_error(L, "watch: out of memory");
+    }
+
+    int i = find_watcher(set, name);
+    if (i >= 0) {
+        free(set->watchers[i].module);
+        free(set->reads[i].string);
+        free(set->previous[i].string);
+        entry.name = set->watchers[i].name;
+    } else {
+        if (set->count == set->capacity && !grow_watchers(set)) {
+            free(entry.module);
+            return luaL_error(L, "watch: out of memory");
+        }
+        i = set->count++;
+        entry.name = strdup(name);
+    }
+    set->watchers[i] = entry;
+    set->reads[i] = read;
+    set->previous[i] = read;
+    set->primed = false;
+
+    if (set->current_ref == LUA_NOREF) {
+        lua_newtable(L);
+        set->current_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        lua_newtable(L);
+        set->old_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+
+    return 0;
+}
+
+static void fill_table(lua_State* L, const watcher_set* set, int ref, const memory_read* reads)
+{
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    for (int i = 0; i < set->count; i++) {
+        push_memory_read(L, &reads[i]);
+        lua_setfield(L, -2, set->watchers[i].name);
+    }
+    lua_pop(L, 1);
+}
+
+/*
+    Reads every watcher and publishes the values
+    Called once per tick before `state`
+*/
+void update_watchers(lua_State* L)
+{
+    watcher_set* set = get_watcher_set(L, false);
+    if (set == NULL || set->count == 0)
+        return;
+
+    for (int i = 0; i < set->count; i++) {
+        watcher* w = &set->watchers[i];
+        // Looked up again once the index was rebuilt, the module may have moved
+        if (w->module != NULL && (w->base == 0 || w->generation != module_index_generation())) {
+            w->base = find_base_address(w->module);
+            w->generation = module_index_generation();
+        }
+
+        free(set->previous[i].string);
+        set->previous[i] = set->reads[i];
+        set->reads[i].string = NULL;
+        set->reads[i].address = w->base + w->module_offset;
+    }
+
+    read_memory_batch(set->reads, set->count);
+
+    int ref = set->current_ref;
+    set->current_ref = set->old_ref;
+    set->old_ref = ref;
+    fill_table(L, set, set->current_ref, set->reads);
+    if (!set->primed) {
+        // Nothing to compare against on the first tick
+        fill_table(L, set, set->old_ref, set->reads);
+        set->primed = true;
+        set->fresh = true;
+    } else {
+        set->fresh = false;
+    }
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, set->current_ref);
+    lua_setglobal(L, "current");
+    lua_rawgeti(L, LUA_REGISTRYINDEX, set->old_ref);
+    lua_setglobal(L, "old");
+}
+
+// Index of the watcher called `name`, -1 if it wasn't declared
+int watcher_index(lua_State* L, const char* name)
+{
+    watcher_set* set = get_watcher_set(L, false);
+    return set != NULL ? find_watcher(set, name) : -1;
+}
+
+/*
+    Whether the last update read something else than the one before for the
+    watcher at `index`, comparing the raw bytes. Everything counts as changed
+    right after a watcher is declared
+*/
+bool watcher_changed(lua_State* L, int index)
+{
+    watcher_set* set = get_watcher_set(L, false);
+    if (set == NULL || index < 0 || index >= set->count)
+        return false;
+    if (!set->primed || set->fresh)
+        return true;
+
+    const memory_read* read = &set->reads[index];
+    const memory_read* previous = &set->previous[index];
+    if (read->error != previous->error)
+        return true;
+    if (read->error != 0)
+        return false;
+    if (read->type == MEMORY_TYPE_STRING) {
+        const char* string = read->string != NULL ? read->string : "";
+        const char* previous_string = previous->string != NULL ? previous->string : "";
+        return strcmp(string, previous_string) != 0;
+    }
+    return memcmp(&read->value, &previous->value, sizeof(read->value)) != 0;
+}
+
+// Frees the watchers of `L`, has to be called before closing it
+void clear_watchers(lua_State* L)
+{
+    watcher_set* set = get_watcher_set(L, false);
+    if (set == NULL)
+        return;
+
+    for (int i = 0; i < set->count; i++) {
+        free(set->watchers[i].name);
+        free(set->watchers[i].module);
+        free(set->reads[i].string);
+        free(set->previous[i].string);
+    }
+    free(set->watchers);
+    free(set->reads);
+    free(set->previous);
+    if (set->current_ref != LUA_NOREF) {
+        luaL_unref(L, LUA_REGISTRYINDEX, set->current_ref);
+        luaL_unref(L, LUA_REGISTRYINDEX, set->old_ref);
+    }
+    free(set);
+
+    lua_pushlightuserdata(L, &watcher_set_key);
+    lua_pushnil(L);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+}
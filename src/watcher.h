@@ -0,0 +1,14 @@
+#ifndef __WATCHER_H__
+#define __WATCHER_H__
+
+#include <stdbool.h>
+
+#include <luajit.h>
+
+int watch(lua_State* L);
+void update_watchers(lua_State* L);
+void clear_watchers(lua_State* L);
+int watcher_index(lua_State* L, const char* name);
+bool watcher_changed(lua_State* L, int index);
+
+#endif /* __WATCHER_H__ */
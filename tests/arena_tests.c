@@ -0,0 +1,185 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include "assert_macro.h"
+#include "lua-arena.h"
+
+/*
+    The allocator of the auto splitter states: blocks of every size keep
+    their contents through resizes, the usage adds up and the limit is
+    enforced, by itself and under a LuaJIT state
+*/
+
+#define TEST_LIMIT (4 * 1024 * 1024)
+
+static int test_blocks()
+{
+    int err_code = 0;
+    lua_arena* arena = lua_arena_create(0);
+    assertEqual(arena != NULL);
+
+    // Every size class and a few sizes that get their own mapping
+    static uint8_t* blocks[6000];
+    size_t sizes[6000];
+    for (int i = 0; i < 6000; i++) {
+        sizes[i] = i + 1;
+        blocks[i] = lua_arena_alloc(arena, NULL, 0, sizes[i]);
+        assertEqual(blocks[i] != NULL && ((uintptr_t)blocks[i] & 15) == 0);
+        memset(blocks[i], i & 0xFF, sizes[i]);
+    }
+    lua_arena_usage usage = lua_arena_get_usage(arena);
+    assertEqual(usage.used >= 6000 * 6001 / 2 && usage.peak == usage.used);
+
+    // Grow and shrink across classes and mappings, the contents stay
+    for (int i = 0; i < 6000; i++) {
+        size_t size = i % 2 == 0 ? sizes[i] * 3 : sizes[i] / 2 + 1;
+        blocks[i] = lua_arena_alloc(arena, blocks[i], sizes[i], size);
+        assertEqual(blocks[i] != NULL);
+        size_t kept = size < sizes[i] ? size : sizes[i];
+        for (size_t j = 0; j < kept; j += 97)
+            assertEqual(blocks[i][j] == (i & 0xFF));
+        sizes[i] = size;
+    }
+
+    for (int i = 0; i < 6000; i++)
+        assertEqual(lua_arena_alloc(arena, blocks[i], sizes[i], 0) == NULL);
+    usage = lua_arena_get_usage(arena);
+    assertEqual(usage.used == 0 && usage.peak > 0);
+    assertEqual(usage.limit_hits == 0);
+
+    // Freed blocks are used again before anything new is mapped
+    size_t mapped = usage.mapped;
+    void* block = lua_arena_alloc(arena, NULL, 0, 100);
+    assertEqual(lua_arena_get_usage(arena).mapped == mapped);
+    lua_arena_alloc(arena, block, 100, 0);
+
+    lua_arena_destroy(arena);
+    return err_code;
+}
+
+/*
+    Sizes that change over time while little is in use at once, the limit is
+    on what's in use and empty chunks are given back
+*/
+static int test_churn()
+{
+    int err_code = 0;
+    lua_arena* arena = lua_arena_create(TEST_LIMIT);
+    static void* blocks[TEST_LIMIT / 8 / 16];
+    void* kept[200];
+
+    for (int round = 0; round < 200; round++) {
+        size_t size = 16 + round * 37 % 4080;
+        int count = TEST_LIMIT / 8 / size;
+        for (int i = 0; i < count; i++) {
+            blocks[i] = lua_arena_alloc(arena, NULL, 0, size);
+            assertEqual(blocks[i] != NULL);
+        }
+        // One block of every round stays, it keeps a chunk of its class mapped
+        kept[round] = blocks[0];
+        for (int i = 1; i < count; i++)
+            lua_arena_alloc(arena, blocks[i], size, 0);
+    }
+
+    lua_arena_usage usage = lua_arena_get_usage(arena);
+    assertEqual(usage.limit_hits == 0);
+    assertEqual(usage.mapped <= TEST_LIMIT / 2);
+
+    for (int round = 0; round < 200; round++)
+        lua_arena_alloc(arena, kept[round], 16 + round * 37 % 4080, 0);
+    usage = lua_arena_get_usage(arena);
+    assertEqual(usage.used == 0);
+    lua_arena_destroy(arena);
+    return err_code;
+}
+
+static int test_limit()
+{
+    int err_code = 0;
+    lua_arena* arena = lua_arena_create(TEST_LIMIT);
+
+    assertEqual(lua_arena_alloc(arena, NULL, 0, TEST_LIMIT + 1) == NULL);
+    void* block = lua_arena_alloc(arena, NULL, 0, TEST_LIMIT / 2);
+    assertEqual(block != NULL);
+    assertEqual(lua_arena_alloc(arena, block, TEST_LIMIT / 2, TEST_LIMIT * 2) == NULL);
+    // Shrinking never fails
+    block = lua_arena_alloc(arena, block, TEST_LIMIT / 2, 64);
+    assertEqual(block != NULL);
+    lua_arena_alloc(arena, block, 64, 0);
+
+    lua_arena_usage usage = lua_arena_get_usage(arena);
+    assertEqual(usage.limit_hits == 2);
+    assertEqual(usage.mapped <= TEST_LIMIT);
+    lua_arena_destroy(arena);
+    return err_code;
+}
+
+// Host side code that runs out of memory, like the auto splitter's
+static int fill_memory(lua_State* L)
+{
+    lua_newtable(L);
+    for (int i = 1;; i++) {
+        lua_pushnumber(L, i);
+        lua_rawseti(L, -2, i);
+    }
+    return 0;
+}
+
+static int test_state()
+{
+    int err_code = 0;
+    lua_arena* arena = lua_arena_create(TEST_LIMIT);
+    lua_State* L = lua_arena_newstate(arena);
+    if (L == NULL) {
+        printf("This LuaJIT only takes its own allocator, skipping the state tests\n");
+        lua_arena_destroy(arena);
+        return 0;
+    }
+    assertEqual(lua_arena_of(L) == arena);
+    luaL_openlibs(L);
+
+    const char* script = "local t = {} for i = 1, 1e8 do t[i] = { i } end";
+    assertEqual(luaL_loadstring(L, script) == LUA_OK);
+    assertEqual(lua_pcall(L, 0, 0, 0) == LUA_ERRMEM);
+    lua_pop(L, 1);
+
+    lua_arena_usage usage = lua_arena_get_usage(arena);
+    assertEqual(usage.limit_hits > 0);
+    assertEqual(usage.peak <= TEST_LIMIT);
+
+    // Under lua_cpcall it's an error instead of the panic function
+    assertEqual(lua_cpcall(L, fill_memory, NULL) == LUA_ERRMEM);
+    lua_pop(L, 1);
+
+    // Still usable once the garbage is gone
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    assertEqual(luaL_dostring(L, "return #string.rep('x', 1000)") == LUA_OK && lua_tointeger(L, -1) == 1000);
+    assertEqual(lua_arena_get_usage(arena).used < usage.used);
+
+    lua_close(L);
+    assertEqual(lua_arena_get_usage(arena).used == 0);
+    lua_arena_destroy(arena);
+
+    lua_State* system = luaL_newstate();
+    assertEqual(lua_arena_of(system) == NULL);
+    lua_close(system);
+    return err_code;
+}
+
+int main()
+{
+    int err_code = 0;
+    if (test_blocks() != 0)
+        err_code = 1;
+    if (test_churn() != 0)
+        err_code = 1;
+    if (test_limit() != 0)
+        err_code = 1;
+    if (test_state() != 0)
+        err_code = 1;
+    return err_code;
+}
@@ -1,16 +1,15 @@
 #ifndef ASSERT_MACRO_H
 #define ASSERT_MACRO_H
-#define assertEqual( ... )               \
-do {                                            \
-if( !( __VA_ARGS__ ) ) {                     \
-std::cerr << "Unit test assert [ " \
-<< ( #__VA_ARGS__ )             \
-<< " ] failed in line [ "       \
-<< __LINE__                     \
-<< " ] file [ "                 \
-<< __FILE__ << " ]"             \
-<< std::endl;                     \
-err_code = 1;                           \
-}                                            \
-} while( false )
-#endif //ASSERT_MACRO_H
+
+#include <stdio.h>
+
+#define assertEqual(...)                                                    \
+    do {                                                                    \
+        if (!(__VA_ARGS__)) {                                               \
+            fprintf(stderr, "Unit test assert [ %s ] failed in line [ %d ] " \
+                            "file [ %s ]\n",                                \
+                #__VA_ARGS__, __LINE__, __FILE__);                          \
+            err_code = 1;                                                   \
+        }                                                                   \
+    } while (0)
+#endif // ASSERT_MACRO_H
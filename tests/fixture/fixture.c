@@ -0,0 +1,139 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fixture.h"
+
+/*
+    Target process for the memory tests
+    Prints where its values live, then updates them on a fixed schedule until
+    its stdin is closed. Every line of the layout is "<name> <module> <offset>",
+    the offset being relative to the base address of the module, "-" for the
+    executable itself. The layout ends with "ready"
+    FIXTURE_SWAP_COMMAND on stdin points the root to the other middle and leaf
+*/
+
+struct fixture_leaf {
+    int64_t padding;
+    int32_t health;
+    float speed;
+    double position;
+    char name[16];
+    bool loading;
+};
+
+struct fixture_middle {
+    char padding[FIXTURE_MIDDLE_LEAF];
+    struct fixture_leaf* leaf;
+};
+
+struct fixture_root {
+    char padding[FIXTURE_ROOT_MIDDLE];
+    struct fixture_middle* middle;
+};
+
+_Static_assert(offsetof(struct fixture_leaf, health) == FIXTURE_LEAF_HEALTH, "fixture.h is out of date");
+_Static_assert(offsetof(struct fixture_leaf, speed) == FIXTURE_LEAF_SPEED, "fixture.h is out of date");
+_Static_assert(offsetof(struct fixture_leaf, position) == FIXTURE_LEAF_POSITION, "fixture.h is out of date");
+_Static_assert(offsetof(struct fixture_leaf, name) == FIXTURE_LEAF_NAME, "fixture.h is out of date");
+_Static_assert(offsetof(struct fixture_leaf, loading) == FIXTURE_LEAF_LOADING, "fixture.h is out of date");
+
+static struct fixture_root root;
+struct fixture_root* volatile fixture_root = &root;
+
+volatile int32_t fixture_ticks = 0;
+volatile int64_t fixture_values[FIXTURE_VALUE_COUNT];
+const char fixture_string[] = FIXTURE_STRING;
+
+typedef void (*module_tick)();
+
+static void print_offset(const char* name, const void* address, bool main_module)
+{
+    Dl_info info;
+    if (dladdr(address, &info) == 0 || info.dli_fbase == NULL) {
+        fprintf(stderr, "No module holds %s\n", name);
+        exit(1);
+    }
+    const char* module = "-";
+    if (!main_module) {
+        module = strrchr(info.dli_fname, '/') ? strrchr(info.dli_fname, '/') + 1 : info.dli_fname;
+    }
+    printf("%s %s %#lx\n", name, module, (unsigned long)((uintptr_t)address - (uintptr_t)info.dli_fbase));
+}
+
+static module_tick load_module(const char* path, const char* name)
+{
+    void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        fprintf(stderr, "Couldn't load %s: %s\n", path, dlerror());
+        exit(1);
+    }
+    print_offset(name, dlsym(handle, "fixture_module"), false);
+    return (module_tick)dlsym(handle, "fixture_module_tick");
+}
+
+static void tick()
+{
+    struct fixture_leaf* leaf = fixture_root->middle->leaf;
+    fixture_ticks++;
+    leaf->position = fixture_ticks * FIXTURE_POSITION_STEP;
+    if (fixture_ticks % FIXTURE_LOADING_TICKS == 0)
+        leaf->loading = !leaf->loading;
+}
+
+static struct fixture_middle* new_middle(int32_t health)
+{
+    struct fixture_middle* middle = calloc(1, sizeof(struct fixture_middle));
+    struct fixture_leaf* leaf = calloc(1, sizeof(struct fixture_leaf));
+    if (middle == NULL || leaf == NULL)
+        exit(1);
+    leaf->health = health;
+    leaf->speed = FIXTURE_SPEED;
+    snprintf(leaf->name, sizeof(leaf->name), "%s", FIXTURE_NAME);
+    middle->leaf = leaf;
+    return middle;
+}
+
+int main(int argc, char* argv[])
+{
+    struct fixture_middle* middles[] = { new_middle(FIXTURE_HEALTH), new_middle(FIXTURE_OTHER_HEALTH) };
+    root.middle = middles[0];
+    for (int i = 0; i < FIXTURE_VALUE_COUNT; i++)
+        fixture_values[i] = FIXTURE_VALUE(i);
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    print_offset("root", (const void*)&fixture_root, true);
+    print_offset("ticks", (const void*)&fixture_ticks, true);
+    print_offset("values", (const void*)fixture_values, true);
+    print_offset("string", fixture_string, true);
+    module_tick ticks[] = {
+        load_module(FIXTURE_MODULE_A, "module_a"),
+        load_module(FIXTURE_MODULE_B, "module_b"),
+    };
+    printf("ready\n");
+
+    // Runs until the test closes our stdin, or gives up after a while
+    struct pollfd input = { .fd = STDIN_FILENO, .events = POLLIN };
+    for (int i = 0; i < FIXTURE_LIFETIME_TICKS; i++) {
+        int ready = poll(&input, 1, FIXTURE_TICK_MS);
+        if (ready != 0) {
+            char buffer[64];
+            ssize_t length = ready < 0 ? -1 : read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (length <= 0)
+                break;
+            if (memchr(buffer, FIXTURE_SWAP_COMMAND, length) != NULL)
+                root.middle = root.middle == middles[0] ? middles[1] : middles[0];
+        }
+        tick();
+        for (size_t module = 0; module < sizeof(ticks) / sizeof(ticks[0]); module++)
+            ticks[module]();
+    }
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef __FIXTURE_H__
+#define __FIXTURE_H__
+
+#include <stdint.h>
+
+/*
+    Memory layout of the fixture process, shared with the tests reading it
+*/
+
+#define FIXTURE_TICK_MS 10
+#define FIXTURE_LIFETIME_TICKS 6000 // Exits on its own after a minute
+#define FIXTURE_LOADING_TICKS 5 // `loading` flips every 5 ticks
+
+// Pointer chain: root -> middle -> leaf, both allocated on the heap
+#define FIXTURE_ROOT_MIDDLE 0x20
+#define FIXTURE_MIDDLE_LEAF 0x10
+#define FIXTURE_LEAF_HEALTH 0x8 // int
+#define FIXTURE_LEAF_SPEED 0xC // float
+#define FIXTURE_LEAF_POSITION 0x10 // double, ticks * FIXTURE_POSITION_STEP
+#define FIXTURE_LEAF_NAME 0x18 // char[16]
+#define FIXTURE_LEAF_LOADING 0x28 // bool
+
+#define FIXTURE_HEALTH 100
+#define FIXTURE_OTHER_HEALTH 50 // Health of the leaf the root points to once swapped
+#define FIXTURE_SPEED 2.5f
+#define FIXTURE_POSITION_STEP 0.5
+#define FIXTURE_NAME "LibreSplit"
+#define FIXTURE_STRING "fixture string"
+
+// Written to the fixture's stdin, swaps the middle the root points to
+#define FIXTURE_SWAP_COMMAND 's'
+
+// Array of long, FIXTURE_VALUE(i) at index i
+#define FIXTURE_VALUE_COUNT 4096
+#define FIXTURE_VALUE(i) ((int64_t)(i) * 3 + 1)
+
+// The struct exported by both shared objects
+#define FIXTURE_MODULE_ID_OFFSET 0x0 // int, 0xA or 0xB
+#define FIXTURE_MODULE_NAME_OFFSET 0x4 // char[16]
+#define FIXTURE_MODULE_COUNTER 0x18 // int*, incremented by the id every tick
+
+#endif /* __FIXTURE_H__ */
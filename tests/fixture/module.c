@@ -0,0 +1,33 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fixture.h"
+
+/*
+    Shared object the fixture loads with dlopen
+    It's built twice, FIXTURE_MODULE_ID tells the copies apart
+*/
+
+struct fixture_module {
+    int32_t id;
+    char name[16];
+    int32_t* counter;
+};
+
+_Static_assert(offsetof(struct fixture_module, id) == FIXTURE_MODULE_ID_OFFSET, "fixture.h is out of date");
+_Static_assert(offsetof(struct fixture_module, name) == FIXTURE_MODULE_NAME_OFFSET, "fixture.h is out of date");
+_Static_assert(offsetof(struct fixture_module, counter) == FIXTURE_MODULE_COUNTER, "fixture.h is out of date");
+
+int32_t fixture_module_counter = 0;
+
+struct fixture_module fixture_module = {
+    FIXTURE_MODULE_ID,
+    FIXTURE_MODULE_NAME,
+    &fixture_module_counter,
+};
+
+// Called by the fixture on every tick
+void fixture_module_tick()
+{
+    fixture_module_counter += FIXTURE_MODULE_ID;
+}
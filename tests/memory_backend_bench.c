@@ -0,0 +1,115 @@
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memory-backend.h"
+
+/*
+    Compares the memory backends against a forked copy of this process
+    The child keeps the same address space layout, so the parent knows where
+    every value lives without any extra communication
+*/
+
+#define VALUE_COUNT 4096
+#define BATCH_SIZE 64
+#define STRIDE 64 // 512 bytes between two values of a batch
+#define ITERATIONS 2000
+
+static uint64_t values[VALUE_COUNT];
+
+static long long now_ns(void)
+{
+    struct timespec timespec;
+    clock_gettime(CLOCK_MONOTONIC, &timespec);
+    return timespec.tv_sec * 1000000000LL + timespec.tv_nsec;
+}
+
+static int run_backend(const char* name, pid_t pid)
+{
+    uint64_t results[BATCH_SIZE];
+    struct iovec local[BATCH_SIZE];
+    struct iovec remote[BATCH_SIZE];
+    int32_t errors[BATCH_SIZE];
+    int err_code = 0;
+
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        local[i].iov_base = &results[i];
+        local[i].iov_len = sizeof(uint64_t);
+        remote[i].iov_base = &values[i * STRIDE];
+        remote[i].iov_len = sizeof(uint64_t);
+    }
+
+    memory_backend_detach();
+    if (!memory_backend_select(name))
+        return 1;
+    // Attach outside of the measurements
+    memory_backend_read(pid, local, remote, errors, 1);
+    if (strcmp(memory_backend_name(), name) != 0) {
+        printf("%-10s unavailable, skipped\n", name);
+        return 0;
+    }
+
+    long long start = now_ns();
+    for (int iteration = 0; iteration < ITERATIONS; iteration++) {
+        memory_backend_read(pid, local, remote, errors, BATCH_SIZE);
+    }
+    long long batched = now_ns() - start;
+
+    start = now_ns();
+    for (int iteration = 0; iteration < ITERATIONS; iteration++) {
+        for (int i = 0; i < BATCH_SIZE; i++)
+            memory_backend_read(pid, &local[i], &remote[i], &errors[i], 1);
+    }
+    long long single = now_ns() - start;
+
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        if (errors[i] != 0 || results[i] != values[i * STRIDE]) {
+            printf("%-10s wrong value at %d (error %d)\n", name, i, errors[i]);
+            err_code = 1;
+        }
+    }
+
+    // Unmapped memory has to be reported as a fault
+    uint64_t unmapped = 0;
+    struct iovec unmapped_local = { &unmapped, sizeof(unmapped) };
+    struct iovec unmapped_remote = { (void*)16, sizeof(unmapped) };
+    int32_t unmapped_error = 0;
+    memory_backend_read(pid, &unmapped_local, &unmapped_remote, &unmapped_error, 1);
+    if (unmapped_error == 0) {
+        printf("%-10s read unmapped memory\n", name);
+        err_code = 1;
+    }
+
+    printf("%-10s batched: %7.1f ns/value  single: %7.1f ns/value\n", name,
+        (double)batched / (ITERATIONS * BATCH_SIZE),
+        (double)single / (ITERATIONS * BATCH_SIZE));
+    return err_code;
+}
+
+int main()
+{
+    int err_code = 0;
+
+    for (int i = 0; i < VALUE_COUNT; i++)
+        values[i] = (uint64_t)i * 0x9E3779B97F4A7C15ULL;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        pause();
+        return 0;
+    }
+
+    for (int i = 0; memory_backends[i] != NULL; i++) {
+        if (run_backend(memory_backends[i]->name, pid))
+            err_code = 1;
+    }
+
+    memory_backend_detach();
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return err_code;
+}
@@ -0,0 +1,441 @@
+#include <inttypes.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include "assert_macro.h"
+#include "fixture/fixture.h"
+#include "memory-backend.h"
+#include "memory.h"
+#include "process.h"
+
+/*
+    Reads the fixture process through the same code the auto splitters use:
+    process discovery, module base addresses, readAddress and readAddresses,
+    with every memory backend and with the pointer cache and page snapshot
+*/
+
+#define FIXTURE_PROCESS "libresplit_fixture"
+
+extern _Thread_local game_process process;
+
+typedef struct fixture_offset {
+    char name[32];
+    char module[64]; // "-" for the executable
+    uint64_t offset;
+} fixture_offset;
+
+static fixture_offset fixture_offsets[16];
+static int fixture_offset_count = 0;
+static pid_t fixture_pid = 0;
+static FILE* fixture_input = NULL;
+
+// Caching options every backend is tested with
+static const struct {
+    const char* name;
+    int pointer_cache_cycles;
+    bool page_snapshot_enabled;
+} cache_configs[] = {
+    { "no cache", 0, false },
+    { "pointer cache", 1, false },
+    { "pointer cache over 4 cycles", 4, false },
+    { "page snapshot", 1, true },
+};
+
+/*
+    Starts the fixture and reads its layout
+    It exits once `fixture_input` is closed
+*/
+static bool start_fixture()
+{
+    int input[2];
+    int output[2];
+    if (pipe(input) == -1 || pipe(output) == -1)
+        return false;
+
+    fixture_pid = fork();
+    if (fixture_pid == -1)
+        return false;
+    if (fixture_pid == 0) {
+        dup2(input[0], STDIN_FILENO);
+        dup2(output[1], STDOUT_FILENO);
+        close(input[0]);
+        close(input[1]);
+        close(output[0]);
+        close(output[1]);
+        execl(FIXTURE_PATH, FIXTURE_PATH, (char*)NULL);
+        _exit(127);
+    }
+    close(input[0]);
+    close(output[1]);
+    fixture_input = fdopen(input[1], "w");
+
+    FILE* layout = fdopen(output[0], "r");
+    char line[256];
+    bool ready = false;
+    while (!ready && fgets(line, sizeof(line), layout) != NULL) {
+        if (strcmp(line, "ready\n") == 0) {
+            ready = true;
+        } else if (fixture_offset_count < (int)(sizeof(fixture_offsets) / sizeof(fixture_offsets[0]))) {
+            fixture_offset* offset = &fixture_offsets[fixture_offset_count];
+            if (sscanf(line, "%31s %63s %" SCNx64, offset->name, offset->module, &offset->offset) == 3)
+                fixture_offset_count++;
+        }
+    }
+    fclose(layout);
+    return ready;
+}
+
+static void stop_fixture()
+{
+    if (fixture_input != NULL)
+        fclose(fixture_input);
+    if (fixture_pid > 0)
+        waitpid(fixture_pid, NULL, 0);
+}
+
+static const fixture_offset* fixture_offset_of(const char* name)
+{
+    for (int i = 0; i < fixture_offset_count; i++) {
+        if (strcmp(fixture_offsets[i].name, name) == 0)
+            return &fixture_offsets[i];
+    }
+    fprintf(stderr, "The fixture didn't print the offset of %s\n", name);
+    exit(1);
+}
+
+static uint64_t offset_of(const char* name)
+{
+    return fixture_offset_of(name)->offset;
+}
+
+static const char* module_of(const char* name)
+{
+    return fixture_offset_of(name)->module;
+}
+
+// Runs a chunk of Lua and leaves the value it returns on the stack
+static bool run(lua_State* L, const char* format, ...)
+{
+    char chunk[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(chunk, sizeof(chunk), format, args);
+    va_end(args);
+
+    lua_settop(L, 0);
+    if (luaL_loadstring(L, chunk) != 0 || lua_pcall(L, 0, 1, 0) != 0) {
+        fprintf(stderr, "%s\n%s\n", chunk, lua_tostring(L, -1));
+        lua_settop(L, 0);
+        lua_pushnil(L);
+        return false;
+    }
+    return true;
+}
+
+static lua_State* new_state()
+{
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    lua_pushcfunction(L, find_process_id);
+    lua_setglobal(L, "process");
+    lua_pushcfunction(L, read_address);
+    lua_setglobal(L, "readAddress");
+    lua_pushcfunction(L, read_addresses);
+    lua_setglobal(L, "readAddresses");
+    lua_pushcfunction(L, getPid);
+    lua_setglobal(L, "getPID");
+    return L;
+}
+
+static int test_process_discovery(lua_State* L)
+{
+    int err_code = 0;
+
+    assertEqual(run(L, "process('%s', 'newest')", FIXTURE_PROCESS));
+    assertEqual(run(L, "return getPID()") && lua_tointeger(L, -1) == fixture_pid);
+    assertEqual(process.base_address != 0);
+    assertEqual(process.base_address == find_base_address(NULL));
+    assertEqual(process.base_address == find_base_address(FIXTURE_PROCESS));
+
+    // Asking again for the process we're attached to keeps it
+    assertEqual(run(L, "process('%s')", FIXTURE_PROCESS));
+    assertEqual(process.pid == fixture_pid);
+
+    return err_code;
+}
+
+static int test_base_addresses()
+{
+    int err_code = 0;
+
+    const char* module_a = module_of("module_a");
+    const char* module_b = module_of("module_b");
+    uintptr_t base_a = find_base_address(module_a);
+    uintptr_t base_b = find_base_address(module_b);
+    assertEqual(base_a != 0);
+    assertEqual(base_b != 0);
+    assertEqual(base_a != base_b);
+    assertEqual(base_a != process.base_address && base_b != process.base_address);
+
+    const process_module* module = find_module(module_a);
+    assertEqual(module != NULL && module->base == base_a && module->end > base_a);
+    module = find_module(module_b);
+    assertEqual(module != NULL && module->base == base_b && module->end > base_b);
+
+    const process_region* region = find_region(base_a + offset_of("module_a"));
+    assertEqual(region != NULL && region->perms[0] == 'r');
+    assertEqual(find_module("libfixture_missing.so") == NULL);
+
+    // Base addresses found before a rebuild are known to be out of date
+    uint32_t generation = module_index_generation();
+    assertEqual(find_module(module_a) != NULL && module_index_generation() == generation);
+    invalidate_modules();
+    assertEqual(module_index_generation() != generation);
+    assertEqual(find_base_address(module_a) == base_a);
+
+    return err_code;
+}
+
+// Static values, pointer chains and modules, through readAddress and readAddresses
+static int test_reads(lua_State* L, const char* backend, const char* config)
+{
+    int err_code = 0;
+    uint64_t root = offset_of("root");
+    uint64_t values = offset_of("values");
+    const char* module_a = module_of("module_a");
+    const char* module_b = module_of("module_b");
+    uint64_t offset_a = offset_of("module_a");
+    uint64_t offset_b = offset_of("module_b");
+
+    // Twice, so the second pass goes through whatever the first one cached
+    for (int pass = 0; pass < 2; pass++) {
+        memory_tick_start();
+        assertEqual(run(L, "return readAddress('int', %#" PRIx64 ", %#x, %#x, %#x)", root, FIXTURE_ROOT_MIDDLE, FIXTURE_MIDDLE_LEAF, FIXTURE_LEAF_HEALTH)
+            && lua_tointeger(L, -1) == FIXTURE_HEALTH);
+        assertEqual(run(L, "return readAddress('float', %#" PRIx64 ", %#x, %#x, %#x)", root, FIXTURE_ROOT_MIDDLE, FIXTURE_MIDDLE_LEAF, FIXTURE_LEAF_SPEED)
+            && lua_tonumber(L, -1) == FIXTURE_SPEED);
+        assertEqual(run(L, "return readAddress('string16', %#" PRIx64 ", %#x, %#x, %#x)", root, FIXTURE_ROOT_MIDDLE, FIXTURE_MIDDLE_LEAF, FIXTURE_LEAF_NAME)
+            && strcmp(lua_tostring(L, -1), FIXTURE_NAME) == 0);
+        assertEqual(run(L, "return readAddress('string32', %#" PRIx64 ")", offset_of("string"))
+            && strcmp(lua_tostring(L, -1), FIXTURE_STRING) == 0);
+
+        for (int i = 0; i < FIXTURE_VALUE_COUNT; i += FIXTURE_VALUE_COUNT / 8 - 1) {
+            assertEqual(run(L, "return readAddress('long', %#" PRIx64 ")", values + i * sizeof(int64_t))
+                && lua_tonumber(L, -1) == FIXTURE_VALUE(i));
+        }
+
+        assertEqual(run(L, "return readAddress('int', '%s', %#" PRIx64 ")", module_a, offset_a + FIXTURE_MODULE_ID_OFFSET)
+            && lua_tointeger(L, -1) == 0xA);
+        assertEqual(run(L, "return readAddress('int', '%s', %#" PRIx64 ")", module_b, offset_b + FIXTURE_MODULE_ID_OFFSET)
+            && lua_tointeger(L, -1) == 0xB);
+        assertEqual(run(L, "return readAddress('string16', '%s', %#" PRIx64 ")", module_a, offset_a + FIXTURE_MODULE_NAME_OFFSET)
+            && strcmp(lua_tostring(L, -1), "fixture_a") == 0);
+        // The counter is only ever a multiple of the module's id
+        assertEqual(run(L, "return readAddress('int', '%s', %#" PRIx64 ", 0)", module_b, offset_b + FIXTURE_MODULE_COUNTER)
+            && lua_tointeger(L, -1) >= 0 && lua_tointeger(L, -1) % 0xB == 0);
+
+        // The health isn't a pointer, following it has to fail
+        assertEqual(run(L, "return readAddress('int', %#" PRIx64 ", %#x, %#x, %#x, 0)", root, FIXTURE_ROOT_MIDDLE, FIXTURE_MIDDLE_LEAF, FIXTURE_LEAF_HEALTH)
+            && lua_tointeger(L, -1) == -1);
+
+        assertEqual(run(L,
+            "local values = readAddresses{"
+            "    health = {'int', %#" PRIx64 ", %#x, %#x, %#x},"
+            "    name = {'string16', %#" PRIx64 ", %#x, %#x, %#x},"
+            "    last = {'long', %#" PRIx64 "},"
+            "    id = {'int', '%s', %#" PRIx64 "},"
+            "    broken = {'int', %#" PRIx64 ", %#x, %#x, %#x, 0},"
+            "};"
+            "return values.health == %d and values.name == '%s' and values.last == %" PRId64
+            "    and values.id == 0xB and values.broken == -1",
+            root, FIXTURE_ROOT_MIDDLE, FIXTURE_MIDDLE_LEAF, FIXTURE_LEAF_HEALTH,
+            root, FIXTURE_ROOT_MIDDLE, FIXTURE_MIDDLE_LEAF, FIXTURE_LEAF_NAME,
+            values + (FIXTURE_VALUE_COUNT - 1) * sizeof(int64_t),
+            module_b, offset_b + FIXTURE_MODULE_ID_OFFSET,
+            root, FIXTURE_ROOT_MIDDLE, FIXTURE_MIDDLE_LEAF, FIXTURE_LEAF_HEALTH,
+            FIXTURE_HEALTH, FIXTURE_NAME, FIXTURE_VALUE(FIXTURE_VALUE_COUNT - 1))
+            && lua_toboolean(L, -1));
+
+        memory_tick_end();
+    }
+
+    if (err_code != 0)
+        fprintf(stderr, "Reads failed with %s, %s\n", backend, config);
+    return err_code;
+}
+
+// Values the fixture updates every tick have to be seen changing
+static int test_changing_values(lua_State* L, const char* backend, const char* config)
+{
+    int err_code = 0;
+    uint64_t root = offset_of("root");
+    bool loading_seen[2] = { false, false };
+    lua_Integer first_ticks = -1;
+    lua_Integer last_ticks = -1;
+    double last_position = -1;
+
+    struct timespec delay = { 0, FIXTURE_TICK_MS * 1000000L };
+    for (int i = 0; i < FIXTURE_LOADING_TICKS * 4; i++) {
+        memory_tick_start();
+        if (run(L, "return readAddress('int', %#" PRIx64 ")", offset_of("ticks"))) {
+            lua_Integer ticks = lua_tointeger(L, -1);
+            assertEqual(ticks >= last_ticks);
+            if (first_ticks == -1)
+                first_ticks = ticks;
+            last_ticks = ticks;
+        }
+        if (run(L, "return readAddress('double', %#" PRIx64 ", %#x, %#x, %#x)", root, FIXTURE_ROOT_MIDDLE, FIXTURE_MIDDLE_LEAF, FIXTURE_LEAF_POSITION)) {
+            double position = lua_tonumber(L, -1);
+            assertEqual(position >= last_position && fmod(position, FIXTURE_POSITION_STEP) == 0);
+            last_position = position;
+        }
+        if (run(L, "return readAddress('bool', %#" PRIx64 ", %#x, %#x, %#x)", root, FIXTURE_ROOT_MIDDLE, FIXTURE_MIDDLE_LEAF, FIXTURE_LEAF_LOADING))
+            loading_seen[lua_toboolean(L, -1) ? 1 : 0] = true;
+
+        memory_tick_end();
+        nanosleep(&delay, NULL);
+    }
+    assertEqual(last_ticks > first_ticks);
+    assertEqual(loading_seen[0] && loading_seen[1]);
+
+    if (err_code != 0)
+        fprintf(stderr, "Changing values failed with %s, %s\n", backend, config);
+    return err_code;
+}
+
+// Repeated readAddress calls of a tick get the first result, the next tick reads again
+static int test_read_memo(lua_State* L)
+{
+    int err_code = 0;
+    uint64_t ticks = offset_of("ticks");
+    struct timespec delay = { 0, FIXTURE_TICK_MS * 3 * 1000000L };
+
+    memory_tick_start();
+    uint64_t hits = memory_statistics.read_memo_hits;
+    assertEqual(run(L, "return readAddress('int', %#" PRIx64 ")", ticks));
+    lua_Integer first = lua_tointeger(L, -1);
+    nanosleep(&delay, NULL);
+    assertEqual(run(L, "return readAddress('int', %#" PRIx64 ")", ticks) && lua_tointeger(L, -1) == first);
+    assertEqual(memory_statistics.read_memo_hits == hits + 1);
+    // Another type is another read
+    assertEqual(run(L, "return readAddress('uint', %#" PRIx64 ")", ticks) && lua_tointeger(L, -1) > first);
+    assertEqual(memory_statistics.read_memo_hits == hits + 1);
+    memory_tick_end();
+
+    memory_tick_start();
+    assertEqual(run(L, "return readAddress('int', %#" PRIx64 ")", ticks) && lua_tointeger(L, -1) > first);
+    assertEqual(memory_statistics.read_memo_hits == hits + 1);
+    memory_tick_end();
+
+    // Outside of a tick nothing is memoized
+    assertEqual(run(L, "return readAddress('int', %#" PRIx64 ")", ticks));
+    assertEqual(run(L, "return readAddress('int', %#" PRIx64 ")", ticks));
+    assertEqual(memory_statistics.read_memo_hits == hits + 1);
+
+    return err_code;
+}
+
+// Health read through the root, -1 if it can't be read
+static lua_Integer read_health(lua_State* L)
+{
+    if (!run(L, "return readAddress('int', %#" PRIx64 ", %#x, %#x, %#x)", offset_of("root"), FIXTURE_ROOT_MIDDLE, FIXTURE_MIDDLE_LEAF, FIXTURE_LEAF_HEALTH))
+        return -1;
+    return lua_tointeger(L, -1);
+}
+
+// Has the fixture swap its middle and waits until `health` can be read through the root
+static bool swap_fixture_root(lua_State* L, lua_Integer health)
+{
+    struct timespec delay = { 0, FIXTURE_TICK_MS * 1000000L };
+    fputc(FIXTURE_SWAP_COMMAND, fixture_input);
+    fflush(fixture_input);
+    for (int i = 0; i < 100; i++) {
+        if (read_health(L) == health)
+            return true;
+        nanosleep(&delay, NULL);
+    }
+    return false;
+}
+
+// Outside of a tick the pointer cache isn't used, a path that changed is followed again
+static int test_reads_outside_ticks(lua_State* L)
+{
+    int err_code = 0;
+    memory_flush();
+    pointer_cache_cycles = 1;
+
+    assertEqual(read_health(L) == FIXTURE_HEALTH);
+    assertEqual(swap_fixture_root(L, FIXTURE_OTHER_HEALTH));
+    assertEqual(swap_fixture_root(L, FIXTURE_HEALTH));
+
+    return err_code;
+}
+
+static int test_backends(lua_State* L)
+{
+    int err_code = 0;
+
+    for (int i = 0; memory_backends[i] != NULL; i++) {
+        const char* backend = memory_backends[i]->name;
+        memory_backend_detach();
+        memory_flush();
+        assertEqual(memory_backend_select(backend));
+        run(L, "return readAddress('int', %#" PRIx64 ")", offset_of("ticks"));
+        if (strcmp(memory_backend_name(), backend) != 0) {
+            printf("%s unavailable, skipped\n", backend);
+            continue;
+        }
+
+        for (size_t config = 0; config < sizeof(cache_configs) / sizeof(cache_configs[0]); config++) {
+            memory_flush();
+            pointer_cache_cycles = cache_configs[config].pointer_cache_cycles;
+            page_snapshot_enabled = cache_configs[config].page_snapshot_enabled;
+            if (test_reads(L, backend, cache_configs[config].name) != 0)
+                err_code = 1;
+            if (test_changing_values(L, backend, cache_configs[config].name) != 0)
+                err_code = 1;
+        }
+        printf("%s passed\n", backend);
+    }
+
+    return err_code;
+}
+
+int main()
+{
+    int err_code = 0;
+
+    if (!start_fixture()) {
+        fprintf(stderr, "Couldn't start %s\n", FIXTURE_PATH);
+        stop_fixture();
+        return 1;
+    }
+
+    lua_State* L = new_state();
+    if (test_process_discovery(L) == 0) {
+        if (test_base_addresses() != 0)
+            err_code = 1;
+        if (test_read_memo(L) != 0)
+            err_code = 1;
+        if (test_reads_outside_ticks(L) != 0)
+            err_code = 1;
+        if (test_backends(L) != 0)
+            err_code = 1;
+    } else {
+        err_code = 1;
+    }
+    lua_close(L);
+
+    process_detach();
+    stop_fixture();
+    return err_code;
+}
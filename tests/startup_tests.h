@@ -1,4 +1,4 @@
-#ifndef I_TEST_H
+#ifndef STARTUP_TESTS_H
 #define STARTUP_TESTS_H
 
 int initial_test();